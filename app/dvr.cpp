@@ -1,11 +1,16 @@
 #include <app/dvr.hpp>
 #include <common/config.hpp>
+#include <common/clock.hpp>
 #include <protocol/rtmp_amf0.hpp>
 
 // 48kHz/1024=46.874fps
 // 46.875fps*10s=468.75
 #define NUM_TO_JUDGE_DVR_ONLY_HASH_AUDIO 500
 
+// flush the coalesced tags when reach the bytes or the time
+#define DVR_WRITE_BEHIND_BYTES (1024 * 1024)
+#define DVR_WRITE_BEHIND_MS 500
+
 FlvSegment::FlvSegment(DvrPlan *plan)
 {
 	request_ = nullptr;
@@ -25,10 +30,18 @@ FlvSegment::FlvSegment(DvrPlan *plan)
     stream_start_time_ = 0;
     stream_duration_ = 0;
     stream_previous_pkt_time_ = -1;
+    dropping_ = false;
+    nb_dropped_ = 0;
+    pending_bytes_ = 0;
+    pending_time_ = 0;
 }
 
 FlvSegment::~FlvSegment()
 {
+    for (size_t i = 0; i < pending_.size(); i++)
+    {
+        rs_freep(pending_[i]);
+    }
     rs_freep(writer_);
     rs_freep(jitter_);
     rs_freep(muxer_);
@@ -82,6 +95,89 @@ int FlvSegment::on_update_duration(rtmp::SharedPtrMessage *msg)
     return ret;
 }
 
+bool FlvSegment::drop_for_busy(bool is_keyframe)
+{
+    // the dvr is behind the disk, which never blocks the live stream
+    if (writer_->IsBusy())
+    {
+        if (!dropping_)
+        {
+            rs_warn("dvr writer busy, drop frames until keyframe, file=%s", temp_flv_file_.c_str());
+        }
+        dropping_ = true;
+        nb_dropped_++;
+        return true;
+    }
+
+    if (dropping_ && !is_keyframe)
+    {
+        nb_dropped_++;
+        return true;
+    }
+
+    if (dropping_)
+    {
+        rs_trace("dvr writer recovered, dropped=%lld, file=%s", nb_dropped_, temp_flv_file_.c_str());
+    }
+    dropping_ = false;
+    return false;
+}
+
+int FlvSegment::write_behind(rtmp::SharedPtrMessage *msg, int64_t timestamp, bool is_keyframe)
+{
+    int ret = ERROR_SUCCESS;
+
+    // the previous gop is on disk when a keyframe comes
+    if (is_keyframe && (ret = flush()) != ERROR_SUCCESS)
+    {
+        return ret;
+    }
+
+    if (pending_.empty())
+    {
+        pending_time_ = _clock->SteadyMS();
+    }
+
+    rtmp::SharedPtrMessage *tag = msg->Copy();
+    tag->timestamp = timestamp;
+    pending_.push_back(tag);
+    pending_bytes_ += FlvMuxer::SizeTag(msg->size);
+
+    if (pending_bytes_ >= DVR_WRITE_BEHIND_BYTES || _clock->SteadyMS() - pending_time_ >= DVR_WRITE_BEHIND_MS)
+    {
+        return flush();
+    }
+
+    return ret;
+}
+
+int FlvSegment::flush()
+{
+    int ret = ERROR_SUCCESS;
+
+    if (pending_.empty())
+    {
+        return ret;
+    }
+
+    ret = muxer_->WriteTags(&pending_[0], (int)pending_.size());
+
+    for (size_t i = 0; i < pending_.size(); i++)
+    {
+        rs_freep(pending_[i]);
+    }
+    pending_.clear();
+    pending_bytes_ = 0;
+
+    if (ret != ERROR_SUCCESS)
+    {
+        rs_error("flush dvr tags to %s failed. ret=%d", temp_flv_file_.c_str(), ret);
+        return ret;
+    }
+
+    return ret;
+}
+
 int FlvSegment::create_jitter(bool new_flv_file)
 {
     int ret = ERROR_SUCCESS;
@@ -92,7 +188,7 @@ int FlvSegment::create_jitter(bool new_flv_file)
 
         start_time_ = -1;
         stream_previous_pkt_time_ = -1;
-        stream_start_time_ = Utils::GetSteadyMilliSeconds();
+        stream_start_time_ = _clock->SteadyMS();
         stream_duration_ = 0;
 
         has_keyframe_ = false;
@@ -190,6 +286,11 @@ int FlvSegment::UpdateFlvMetadata()
         return ret;
     }
 
+    if ((ret = flush()) != ERROR_SUCCESS)
+    {
+        return ret;
+    }
+
     int64_t cur = writer_->Tellg();
 
     char *buf = new char[AMF0_LEN_NUMBER];
@@ -247,6 +348,12 @@ int FlvSegment::WriteMetadata(rtmp::SharedPtrMessage *shared_metadata)
         return ret;
     }
 
+    // the offsets depend on the position of the metadata
+    if ((ret = flush()) != ERROR_SUCCESS)
+    {
+        return ret;
+    }
+
     BufferManager manager;
     if ((ret = manager.Initialize(metadata->payload, metadata->size)) != ERROR_SUCCESS)
     {
@@ -316,16 +423,18 @@ int FlvSegment::WriteAudio(rtmp::SharedPtrMessage *shared_audio)
     rtmp::SharedPtrMessage *audio = shared_audio->Copy();
     rs_auto_free(rtmp::SharedPtrMessage, audio);
 
-    if (jitter_->Correct(audio, jitter_algorithm_) != ERROR_SUCCESS)
+    if (!FlvDemuxer::IsAudioSeqenceHeader(audio->payload, audio->size) && drop_for_busy(false))
     {
         return ret;
     }
 
-    char *payload = audio->payload;
-    int size = audio->size;
+    if (jitter_->Correct(audio, jitter_algorithm_) != ERROR_SUCCESS)
+    {
+        return ret;
+    }
 
     int64_t timestamp = plan_->filter_timestamp(audio->timestamp);
-    if ((ret = muxer_->WriteAudio(timestamp, payload, size)) != ERROR_SUCCESS)
+    if ((ret = write_behind(audio, timestamp, false)) != ERROR_SUCCESS)
     {
         return ret;
     }
@@ -368,13 +477,18 @@ int FlvSegment::WriteVideo(rtmp::SharedPtrMessage *shared_video)
         }
     }
 
+    if (!is_sequence_header && drop_for_busy(is_keyframe))
+    {
+        return ret;
+    }
+
     if (jitter_->Correct(video, jitter_algorithm_) != ERROR_SUCCESS)
     {
         return ret;
     }
 
     int64_t timestamp = plan_->filter_timestamp(video->timestamp);
-    if ((ret = muxer_->WriteVideo(timestamp, payload, size)) != ERROR_SUCCESS)
+    if ((ret = write_behind(video, timestamp, is_keyframe)) != ERROR_SUCCESS)
     {
         return ret;
     }
@@ -401,6 +515,12 @@ int FlvSegment::Close()
         return ret;
     }
 
+    // reap the segment with all tags
+    if ((ret = flush()) != ERROR_SUCCESS)
+    {
+        return ret;
+    }
+
     if ((ret = UpdateFlvMetadata()) != ERROR_SUCCESS)
     {
         return ret;
@@ -29,6 +29,9 @@ private:
     std::string generate_path();
     int create_jitter(bool new_flv_file);
     int on_update_duration(rtmp::SharedPtrMessage *msg);
+    bool drop_for_busy(bool is_keyframe);
+    int write_behind(rtmp::SharedPtrMessage *msg, int64_t timestamp, bool is_keyframe);
+    int flush();
 
 private:
     rtmp::Request *request_;
@@ -47,6 +50,13 @@ private:
     int64_t stream_start_time_;
     int64_t stream_duration_;
     int64_t stream_previous_pkt_time_;
+    // the disk is slow, drop the frames until next keyframe
+    bool dropping_;
+    int64_t nb_dropped_;
+    // the tags coalesced to one write, by size or time
+    std::vector<rtmp::SharedPtrMessage *> pending_;
+    int pending_bytes_;
+    int64_t pending_time_;
 };
 
 
@@ -6,23 +6,222 @@
 #include <common/core.hpp>
 #include <common/error.hpp>
 #include <common/config.hpp>
+#include <common/aio.hpp>
+#include <common/uring.hpp>
+#include <common/timer.hpp>
+#include <common/clock.hpp>
 #include <app/server.hpp>
 #include <common/listener.hpp>
+#include <app/worker.hpp>
+#include <protocol/rtmp_bridge.hpp>
+#include <protocol/rtmp_consumer.hpp>
 
+#include <pthread.h>
 #include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <vector>
 
 ILog *_log = new FastLog;
 IThreadContext *_context = new ThreadContext;
 Server *_server = new Server();
 Config *_config = new Config();
+Clock *_clock = new Clock();
+thread_local AsyncFileIO *_aio = new AsyncFileIO();
+thread_local rtmp::WakeupScheduler *_wakeup = new rtmp::WakeupScheduler();
+thread_local TimingWheel *_wheel = new TimingWheel();
+#ifdef RS_IO_URING
+thread_local Uring *_uring = new Uring();
+#endif
+rtmp::SourceHub *_hub = nullptr;
 
-int32_t RunMaster()
+// the st and the io of the calling thread, each scheduler thread has its own
+static int32_t initialize_scheduler()
 {
     int32_t ret = ERROR_SUCCESS;
     if ((ret = _server->InitializeST()) != ERROR_SUCCESS)
     {
         return ret;
     }
+
+#ifdef RS_IO_URING
+    if (_config->GetIOBackend() == RS_CONFIG_IO_BACKEND_URING &&
+        (ret = _uring->Initialize(_config->GetUringEntries())) != ERROR_SUCCESS)
+    {
+        return ret;
+    }
+#endif
+
+    if ((ret = _wheel->Initialize(_config->GetTimerTickMS())) != ERROR_SUCCESS)
+    {
+        return ret;
+    }
+
+    if ((ret = _wakeup->Initialize(_config->GetWakeupTickMS())) != ERROR_SUCCESS)
+    {
+        return ret;
+    }
+
+    // the io threads are started after fork, by each worker
+    if ((ret = _aio->Initialize(_config->GetDvrWriterThreads(), _config->GetDvrWriterQueueDepth())) != ERROR_SUCCESS)
+    {
+        return ret;
+    }
+
+    return ret;
+}
+
+static int32_t run_scheduler()
+{
+    int32_t ret = ERROR_SUCCESS;
+
+    RTMPStreamListener listener(_server, ListenerType::RTMP);
+    if ((ret = listener.Listen("0.0.0.0", 1935)) != ERROR_SUCCESS)
+    {
+        return ret;
+    }
+
+    while(1)
+        st_usleep(1000000000);
+    return ret;
+}
+
+static void *scheduler_thread(void *arg)
+{
+    int index = (int)(intptr_t)arg;
+
+    int32_t ret = ERROR_SUCCESS;
+    if ((ret = initialize_scheduler()) == ERROR_SUCCESS)
+    {
+        ret = run_scheduler();
+    }
+
+    rs_error("scheduler thread %d exited, ret=%d", index, ret);
+    return nullptr;
+}
+
+int32_t RunWorker(int index, const std::vector<int> &channels)
+{
+    int32_t ret = ERROR_SUCCESS;
+    // the clock and log threads are started after fork, by each worker
+    if ((ret = _clock->Initialize(_config->GetClockIntervalUS(), _config->GetUTCTime())) != ERROR_SUCCESS)
+    {
+        return ret;
+    }
+
+    if ((ret = _log->Initialize()) != ERROR_SUCCESS)
+    {
+        return ret;
+    }
+
+    if ((ret = initialize_scheduler()) != ERROR_SUCCESS)
+    {
+        return ret;
+    }
+
+    if (!channels.empty())
+    {
+        Worker *worker = new Worker(_server, index, channels);
+        if ((ret = worker->Initialize()) != ERROR_SUCCESS)
+        {
+            rs_error("initialize worker %d failed, ret=%d", index, ret);
+            return ret;
+        }
+        _server->SetWorker(worker);
+    }
+
+    // the threads share the port by SO_REUSEPORT, and the streams by the hub
+    int nb_threads = _config->GetThreads();
+    if (nb_threads > 1)
+    {
+        _hub = new rtmp::SourceHub();
+    }
+    for (int i = 1; i < nb_threads; i++)
+    {
+        pthread_t tid;
+        if (::pthread_create(&tid, nullptr, scheduler_thread, (void *)(intptr_t)i) != 0)
+        {
+            ret = ERROR_SYSTEM_SCHEDULER_THREAD;
+            rs_error("create scheduler thread %d failed, ret=%d", i, ret);
+            return ret;
+        }
+        ::pthread_detach(tid);
+    }
+
+    return run_scheduler();
+}
+
+static pid_t spawn_worker(int index, const std::vector<int> &channels)
+{
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        int ret = RunWorker(index, channels);
+        // the error of worker is still in the log ring
+        _log->Flush();
+        exit(ret);
+    }
+    if (pid < 0)
+    {
+        rs_error("fork worker %d failed, ret=%d", index, ERROR_SYSTEM_FORK);
+        return pid;
+    }
+    rs_trace("fork worker %d, pid=%d", index, pid);
+    return pid;
+}
+
+int32_t RunMaster()
+{
+    int32_t ret = ERROR_SUCCESS;
+
+    int nb_workers = _config->GetWorkers();
+    if (nb_workers <= 1)
+    {
+        return RunWorker(0, std::vector<int>());
+    }
+
+    // the channels are kept by master, so the respawned worker still owns the same streams
+    std::vector<int> channels;
+    if (_config->GetStreamAffinity() && (ret = WorkerCreateChannels(nb_workers, channels)) != ERROR_SUCCESS)
+    {
+        return ret;
+    }
+
+    std::vector<pid_t> pids(nb_workers, -1);
+    for (int i = 0; i < nb_workers; i++)
+    {
+        if ((pids[i] = spawn_worker(i, channels)) < 0)
+        {
+            return ERROR_SYSTEM_FORK;
+        }
+    }
+
+    while (true)
+    {
+        int status = 0;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            ret = ERROR_SYSTEM_WAITPID;
+            rs_error("master waitpid failed, ret=%d", ret);
+            return ret;
+        }
+
+        for (int i = 0; i < nb_workers; i++)
+        {
+            if (pids[i] == pid)
+            {
+                rs_warn("worker %d pid=%d exited, status=%d, respawn it", i, pid, status);
+                pids[i] = spawn_worker(i, channels);
+                break;
+            }
+        }
+    }
+
     return ret;
 }
 
@@ -40,11 +239,7 @@ int32_t main(int argc, char *argv[])
     rs_info("##############################");
 
     signal(SIGPIPE, signal_handler);
-    RunMaster();
-
-    RTMPStreamListener listener(_server, ListenerType::RTMP);
-    listener.Listen("0.0.0.0", 1935);
-    while(1)
-        st_usleep(1000000000);
-    return 0;
+    int32_t ret = RunMaster();
+    _log->Flush();
+    return ret;
 }
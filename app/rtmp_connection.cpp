@@ -6,6 +6,9 @@
 #include <common/config.hpp>
 #include <common/log.hpp>
 #include <common/utils.hpp>
+#include <app/worker.hpp>
+#include <common/uring.hpp>
+#include <common/timer.hpp>
 
 #include <netinet/tcp.h>
 #include <netinet/in.h>
@@ -17,7 +20,16 @@ RTMPConnection::RTMPConnection(Server *server, st_netfd_t stfd): Connection(serv
 {
     request_ = new rtmp::Request;
     response_ = new rtmp::Response;
-    socket_ = new StSocket(stfd);
+#ifdef RS_IO_URING
+    if (_config->GetIOBackend() == RS_CONFIG_IO_BACKEND_URING)
+    {
+        socket_ = new UringSocket(stfd);
+    }
+    else
+#endif
+    {
+        socket_ = new StSocket(stfd);
+    }
     rtmp_ = new RTMPServer(socket_);
     tcp_nodelay_ = false;
     mw_sleep_ = RTMP_MR_SLEEP_MS;
@@ -32,6 +44,30 @@ RTMPConnection::~RTMPConnection()
     rs_freep(socket_);
 }
 
+void *RTMPConnection::operator new(size_t size)
+{
+    if (size != sizeof(RTMPConnection))
+    {
+        return ::operator new(size);
+    }
+    return SlabPool<RTMPConnection>::Alloc();
+}
+
+void RTMPConnection::operator delete(void *p, size_t size)
+{
+    if (size != sizeof(RTMPConnection))
+    {
+        ::operator delete(p);
+        return;
+    }
+    SlabPool<RTMPConnection>::Free(p);
+}
+
+void RTMPConnection::Resume(const char *state, int size)
+{
+    handoff_state_.assign(state, size);
+}
+
 void RTMPConnection::Dispose()
 {
     // if(wakeable_) {
@@ -44,6 +80,12 @@ int32_t RTMPConnection::DoCycle()
     int ret = ERROR_SUCCESS;
     rtmp_->SetRecvTimeout(RTMP_RECV_TIMEOUT_US);
     rtmp_->SetSendTimeout(RTMP_SEND_TIMEOUT_US);
+
+    if (!handoff_state_.empty())
+    {
+        return do_resume();
+    }
+
     if ((ret = rtmp_->Handshake()) != ERROR_SUCCESS)
     {
         rs_error("rtmp handshake failed,ret=%d", ret);
@@ -68,7 +110,7 @@ int32_t RTMPConnection::StreamServiceCycle()
 {
     int ret = ERROR_SUCCESS;
     rtmp::ConnType type;
-    if ((ret = rtmp_->IdentifyClient(response_->stream_id, type, request_->stream, request_->duration)) != ERROR_SUCCESS)
+    if ((ret = rtmp_->IdentifyClient(response_->stream_id, type, request_->stream, request_->duration, request_->start)) != ERROR_SUCCESS)
     {
         rs_error("identify client failed,ret=%d", ret);
         return ret;
@@ -106,14 +148,37 @@ int32_t RTMPConnection::StreamServiceCycle()
 
     rs_trace("client identified, type=%d, stream_name=%s, duration=%.2f", type, request_->stream.c_str(), request_->duration);
 
+    type_ = type;
+
+    Worker *worker = server_->GetWorker();
+    if (worker && _config->GetStreamAffinity())
+    {
+        int owner = worker->GetOwner(request_->GetStreamUrl());
+        if (owner != worker->GetIndex())
+        {
+            if ((ret = handoff(worker, owner)) == ERROR_SUCCESS)
+            {
+                return ERROR_CONTROL_HANDOFF;
+            }
+            rs_warn("handoff %s to worker %d failed, serve it locally. ret=%d", request_->GetStreamUrl().c_str(), owner, ret);
+        }
+    }
+
+    return serve_stream();
+}
+
+int32_t RTMPConnection::serve_stream()
+{
+    int ret = ERROR_SUCCESS;
+
     rtmp::Source *source = nullptr;
     if ((ret = rtmp::Source::FetchOrCreate(request_, server_, &source)) != ERROR_SUCCESS)
     {
         rs_error("FetchOrCreate failed.%d", ret);
         return ret;
     }
-    type_ = type;
-    switch (type)
+
+    switch (type_)
     {
         case rtmp::ConnType::FMLE_PUBLISH:
             rs_info("FMLE start to publish stream %s", request_->stream.c_str());
@@ -138,6 +203,97 @@ int32_t RTMPConnection::StreamServiceCycle()
     return ret;
 }
 
+int32_t RTMPConnection::handoff(Worker *worker, int owner)
+{
+    int ret = ERROR_SUCCESS;
+
+    int size = 1 + 4 + request_->HandoffSize() + rtmp_->HandoffSize();
+    if (size > RS_WORKER_HANDOFF_MAX)
+    {
+        ret = ERROR_SYSTEM_WORKER_HANDOFF;
+        rs_warn("handoff state too large, size=%d, ret=%d", size, ret);
+        return ret;
+    }
+
+    char *state = new char[size];
+    rs_auto_freea(char, state);
+
+    BufferManager manager;
+    if ((ret = manager.Initialize(state, size)) != ERROR_SUCCESS)
+    {
+        return ret;
+    }
+
+    manager.Write1Bytes((int8_t)type_);
+    manager.Write4Bytes(response_->stream_id);
+
+    if ((ret = request_->EncodeHandoff(&manager)) != ERROR_SUCCESS)
+    {
+        return ret;
+    }
+
+    if ((ret = rtmp_->EncodeHandoff(&manager)) != ERROR_SUCCESS)
+    {
+        return ret;
+    }
+
+    return worker->Handoff(owner, st_netfd_fileno(client_stfd_), state, size);
+}
+
+int32_t RTMPConnection::do_resume()
+{
+    int ret = ERROR_SUCCESS;
+
+    BufferManager manager;
+    if ((ret = manager.Initialize(&handoff_state_[0], (int32_t)handoff_state_.size())) != ERROR_SUCCESS)
+    {
+        return ret;
+    }
+
+    if (!manager.Require(5))
+    {
+        ret = ERROR_SYSTEM_WORKER_HANDOFF;
+        rs_error("handoff requires 5 bytes connection, ret=%d", ret);
+        return ret;
+    }
+
+    type_ = (rtmp::ConnType)manager.Read1Bytes();
+    response_->stream_id = manager.Read4Bytes();
+
+    if ((ret = request_->DecodeHandoff(&manager)) != ERROR_SUCCESS)
+    {
+        rs_error("decode handoff request failed, ret=%d", ret);
+        return ret;
+    }
+
+    if ((ret = rtmp_->DecodeHandoff(&manager)) != ERROR_SUCCESS)
+    {
+        rs_error("decode handoff protocol failed, ret=%d", ret);
+        return ret;
+    }
+
+    handoff_state_.clear();
+    request_->ip = client_ip_;
+
+    rs_trace("client resumed, type=%d, url=%s", type_, request_->GetStreamUrl().c_str());
+
+    ret = serve_stream();
+    while (!disposed_)
+    {
+        if (ret == ERROR_CONTROL_HANDOFF)
+        {
+            return ERROR_SUCCESS;
+        }
+        if (ret != ERROR_SUCCESS && !IsSystemControlError(ret))
+        {
+            return ret;
+        }
+        ret = StreamServiceCycle();
+    }
+
+    return ret;
+}
+
 int32_t RTMPConnection::Publishing(rtmp::Source *source)
 {
     int ret = ERROR_SUCCESS;
@@ -152,6 +308,8 @@ int32_t RTMPConnection::Publishing(rtmp::Source *source)
         ret = do_publish(source, &recv_thread);
 
         recv_thread.Stop();
+        // release the stream, so the encoder reconnected to any thread publishes again
+        source->OnUnpublish();
     }
 
     return ret;
@@ -195,14 +353,67 @@ int32_t RTMPConnection::DoPlaying(rtmp::Source* source, rtmp::Consumer* consumer
         if (count <= 0)
         {
             rs_info("mw sleep %dms for no msg", mw_sleep_);
-            st_usleep(mw_sleep_ * 1000);
+            _wheel->Sleep(mw_sleep_ * 1000);
             continue;
         }
         if ((ret = rtmp_->SendAndFreeMessages(msgs.msgs, count, response_->stream_id)) != ERROR_SUCCESS)
         {
             rs_error("send message to client failed.ret=%d", ret);
+            return ret;
+        }
+    }
+    return ret;
+}
+
+int32_t RTMPConnection::do_playing_single(rtmp::Consumer *consumer)
+{
+    int ret = ERROR_SUCCESS;
+    rtmp::MessageArray msgs(RTMP_MR_MSGS);
+
+    while (!disposed_)
+    {
+        if (expired_)
+        {
+            ret = ERROR_USER_DISCONNECT;
+            rs_error("connection expired.ret=%d", ret);
+            return ret;
+        }
+
+        // the client messages are read by the send coroutine when readable
+        int revents = consumer->PollWait(client_stfd_, RTMP_MR_MIN_MSGS, mw_sleep_);
+        // the zerocopy completions raise POLLERR without data, the socket errors are left to recv
+        if (revents == POLLERR && rtmp_->ReapZeroCopy())
+        {
+            revents = 0;
+        }
+        if (revents)
+        {
+            rtmp::CommonMessage *msg = nullptr;
+            if ((ret = rtmp_->RecvMessage(&msg)) != ERROR_SUCCESS)
+            {
+                if (!IsClientGracefullyClose(ret) && !IsSystemControlError(ret))
+                {
+                    rs_error("recv client message failed.ret=%d", ret);
+                }
+                return ret;
+            }
+            rs_freep(msg);
+        }
+
+        int count = 0;
+        if ((ret = consumer->DumpPackets(&msgs, count)) != ERROR_SUCCESS)
+        {
+            rs_error("get message from consumer failed.ret=%d", ret);
+        }
+        if (count <= 0)
+        {
+            continue;
+        }
+        if ((ret = rtmp_->SendAndFreeMessages(msgs.msgs, count, response_->stream_id)) != ERROR_SUCCESS)
+        {
+            rs_error("send message to client failed.ret=%d", ret);
+            return ret;
         }
-        return ret;
     }
     return ret;
 }
@@ -211,12 +422,32 @@ int32_t RTMPConnection::Playing(rtmp::Source* source)
 {
     int ret = ERROR_SUCCESS;
     rtmp::Consumer* consumer = nullptr;
-    if ((ret = source->CreateConsumer(this, consumer)) != ERROR_SUCCESS)
+    if ((ret = source->CreateConsumer(this, consumer, true, true, true, request_->start)) != ERROR_SUCCESS)
     {
         rs_error("create consumer failed.ret=%d", ret);
         return ret;
     }
 
+    if (_config->GetZeroCopy(request_->vhost))
+    {
+        rtmp_->SetZeroCopy(_config->GetZeroCopyThreshold());
+    }
+
+    rtmp_->SetHeaderCompression(_config->GetChunkHeaderCompression(request_->vhost));
+    rtmp_->SetAggregate(_config->GetAggregateSize(request_->vhost));
+
+    if (_config->GetPlaySingleCoroutine(request_->vhost))
+    {
+        rtmp_->SetAutoResponse(true);
+        wakeable_ = consumer;
+        ret = do_playing_single(consumer);
+        wakeable_ = nullptr;
+        rtmp_->SetAutoResponse(false);
+
+        rs_freep(consumer);
+        return 0;
+    }
+
     QueueRecvThread recv_thread(consumer, rtmp_, mw_sleep_);
     if ((ret =recv_thread.Start()) != ERROR_SUCCESS)
     {
@@ -233,6 +464,8 @@ int32_t RTMPConnection::Playing(rtmp::Source* source)
         rs_warn("drop received %d message", recv_thread.Size());
     }
 
+    rs_freep(consumer);
+
     return 0;
 }
 
@@ -270,6 +503,10 @@ int32_t RTMPConnection::ServiceCycle()
     while (!disposed_)
     {
         ret = StreamServiceCycle();
+        if (ret == ERROR_CONTROL_HANDOFF)
+        {
+            return ERROR_SUCCESS;
+        }
         if (ret == ERROR_SUCCESS)
         {
             continue;
@@ -326,6 +563,15 @@ int RTMPConnection::process_publish_message(rtmp::Source *source, rtmp::CommonMe
         }
     }
 
+    if (msg->header.IsAggregate())
+    {
+        if ((ret = source->OnAggregate(msg)) != ERROR_SUCCESS)
+        {
+            rs_error("source process aggregate message failed. ret=%d", ret);
+            return ret;
+        }
+    }
+
     if (msg->header.IsAMF0Data() || msg->header.IsAMF3Data())
     {
         rtmp::Packet *packet = nullptr;
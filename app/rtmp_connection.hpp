@@ -12,6 +12,7 @@
 class PublishRecvThread;
 class QueueRecvThread;
 class IWakeable;
+class Worker;
 
 class RTMPConnection : virtual public Connection
 {
@@ -20,8 +21,14 @@ class RTMPConnection : virtual public Connection
 public:
     RTMPConnection(Server *server, st_netfd_t stfd);
     virtual ~RTMPConnection();
+
+    // allocated from the per thread slab pool
+    static void *operator new(size_t size);
+    static void operator delete(void *p, size_t size);
 public:
     virtual void Dispose();
+    // continue a client identified by other worker, see Worker
+    virtual void Resume(const char *state, int size);
     virtual void Resample() override;
     virtual int64_t GetSendBytesDelta() override;
     virtual int64_t GetRecvBytesDelta() override;
@@ -39,15 +46,20 @@ private:
     int32_t DoPlaying(rtmp::Source *source,
                               rtmp::Consumer* consumer,
                               QueueRecvThread* recv_thread);
+    // the player without recv coroutine, see Consumer::PollWait
+    int32_t do_playing_single(rtmp::Consumer *consumer);
     int handle_publish_message(rtmp::Source *source, rtmp::CommonMessage *msg, bool is_fmle, bool is_edge);
     int process_publish_message(rtmp::Source *source, rtmp::CommonMessage *msg, bool is_edge);
     int do_publish(rtmp::Source *source, PublishRecvThread *recv_thread);
     void set_socket_option();
     int acquire_publish(rtmp::Source *source, bool is_edge);
+    int32_t serve_stream();
+    int32_t handoff(Worker *worker, int owner);
+    int32_t do_resume();
 
 private:
     Server *server_;
-    StSocket *socket_;
+    IProtocolReaderWriter *socket_;
     RTMPServer *rtmp_;
     rtmp::Request *request_;
     rtmp::Response *response_;
@@ -58,6 +70,7 @@ private:
 
     int publish_first_pkt_timeout_;
     int publish_normal_pkt_timeout_;
+    std::string handoff_state_;
 };
 
 #endif
@@ -3,6 +3,7 @@
 #include <common/utils.hpp>
 #include <common/error.hpp>
 #include <common/config.hpp>
+#include <common/timer.hpp>
 
 
 IMessageHandler::IMessageHandler()
@@ -59,7 +60,7 @@ int32_t RTMPRecvThread::Cycle()
     {
         if(!handler_->CanHandler())
         {
-            st_usleep(timeout_ * 1000);
+            _wheel->Sleep(timeout_ * 1000);
             continue;
         }
         rtmp::CommonMessage *msg = nullptr;
@@ -140,7 +141,7 @@ int PublishRecvThread::Wait(int timeout_ms)
         return recv_error_code_;
     }
 
-    st_cond_timedwait(error_, timeout_ms * 1000);
+    _wheel->CondTimedWait(error_, timeout_ms * 1000);
     return ERROR_SUCCESS;
 }
 
@@ -213,7 +214,7 @@ void PublishRecvThread::OnRead(ssize_t nread)
 
     if (nread < RTMP_MR_SMALL_BYTES)
     {
-        st_usleep(mr_sleep_ * 1000);
+        _wheel->Sleep(mr_sleep_ * 1000);
     }
 
 }
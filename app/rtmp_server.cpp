@@ -17,6 +17,25 @@ RTMPServer::~RTMPServer()
     rs_freep(handshake_bytes_);
 }
 
+void *RTMPServer::operator new(size_t size)
+{
+    if (size != sizeof(RTMPServer))
+    {
+        return ::operator new(size);
+    }
+    return SlabPool<RTMPServer>::Alloc();
+}
+
+void RTMPServer::operator delete(void *p, size_t size)
+{
+    if (size != sizeof(RTMPServer))
+    {
+        ::operator delete(p);
+        return;
+    }
+    SlabPool<RTMPServer>::Free(p);
+}
+
 int32_t RTMPServer::Handshake()
 {
     int32_t ret = ERROR_SUCCESS;
@@ -206,19 +225,20 @@ int RTMPServer::IdentiyFlashPublishClient(rtmp::PublishPacket *pkt, rtmp::ConnTy
     return ret;
 }
 
-int RTMPServer::IdentifyPlayClient(rtmp::PlayPacket *pkt, rtmp::ConnType &type, std::string &stream_name, double &duration)
+int RTMPServer::IdentifyPlayClient(rtmp::PlayPacket *pkt, rtmp::ConnType &type, std::string &stream_name, double &duration, double &start)
 {
     int ret = ERROR_SUCCESS;
     type = rtmp::ConnType::PLAY;
     stream_name = pkt->stream_name;
     duration = pkt->duration;
+    start = pkt->start;
 
-    rs_info("identify client type=play, stream_name=%s, duration=%.2f", stream_name.c_str(), duration);
+    rs_info("identify client type=play, stream_name=%s, duration=%.2f, start=%.2f", stream_name.c_str(), duration, start);
 
     return ret;
 }
 
-int RTMPServer::IdentiyCreateStreamClient(rtmp::CreateStreamPacket *pkt, int stream_id, rtmp::ConnType &type, std::string &stream_name, double &duration)
+int RTMPServer::IdentiyCreateStreamClient(rtmp::CreateStreamPacket *pkt, int stream_id, rtmp::ConnType &type, std::string &stream_name, double &duration, double &start)
 {
     int ret = ERROR_SUCCESS;
     rtmp::CreateStreamResPacket *res_pkt = new rtmp::CreateStreamResPacket(pkt->transaction_id, stream_id);
@@ -255,14 +275,14 @@ int RTMPServer::IdentiyCreateStreamClient(rtmp::CreateStreamPacket *pkt, int str
         if (dynamic_cast<rtmp::PlayPacket *>(packet))
         {
             // return IdentiyFlashPublishClient(dynamic_cast<rtmp::PublishPacket *>(packet), type, stream_name);
-            return IdentifyPlayClient(dynamic_cast<rtmp::PlayPacket*>(packet), type, stream_name, duration);
+            return IdentifyPlayClient(dynamic_cast<rtmp::PlayPacket*>(packet), type, stream_name, duration, start);
         }
     }
 
     return ret;
 }
 
-int RTMPServer::IdentifyClient(int stream_id, rtmp::ConnType &type, std::string &stream_name, double &duration)
+int RTMPServer::IdentifyClient(int stream_id, rtmp::ConnType &type, std::string &stream_name, double &duration, double &start)
 {
     int ret = ERROR_SUCCESS;
     type = rtmp::ConnType::UNKNOW;
@@ -305,7 +325,7 @@ int RTMPServer::IdentifyClient(int stream_id, rtmp::ConnType &type, std::string
         }else if (dynamic_cast<rtmp::CreateStreamPacket *>(packet))
         {
             rs_info("identify client by create Stream, fmle publish");
-            return IdentiyCreateStreamClient(dynamic_cast<rtmp::CreateStreamPacket *>(packet), stream_id,type, stream_name, duration);
+            return IdentiyCreateStreamClient(dynamic_cast<rtmp::CreateStreamPacket *>(packet), stream_id,type, stream_name, duration, start);
         }
         else
         {
@@ -427,6 +447,26 @@ void RTMPServer::SetMargeRead(bool v, IMergeReadHandler *handler)
     protocol_->SetMargeRead(v, handler);
 }
 
+void RTMPServer::SetZeroCopy(int threshold)
+{
+    protocol_->SetZeroCopy(threshold);
+}
+
+bool RTMPServer::ReapZeroCopy()
+{
+    return protocol_->ReapZeroCopy();
+}
+
+void RTMPServer::SetHeaderCompression(bool v)
+{
+    protocol_->SetHeaderCompression(v);
+}
+
+void RTMPServer::SetAggregate(int max_size)
+{
+    protocol_->SetAggregate(max_size);
+}
+
 int RTMPServer::DecodeMessage(rtmp::CommonMessage *msg, rtmp::Packet **ppacket)
 {
     protocol_->DecodeMessage(msg, ppacket);
@@ -537,3 +577,18 @@ int stream_id)
 {
     return protocol_->SendAndFreeMessage(msgs, nb_msgs, stream_id);
 }
+
+int RTMPServer::HandoffSize()
+{
+    return protocol_->HandoffSize();
+}
+
+int RTMPServer::EncodeHandoff(BufferManager *manager)
+{
+    return protocol_->EncodeHandoff(manager);
+}
+
+int RTMPServer::DecodeHandoff(BufferManager *manager)
+{
+    return protocol_->DecodeHandoff(manager);
+}
@@ -9,6 +9,10 @@ class RTMPServer
 public:
     RTMPServer(IProtocolReaderWriter *rw);
     virtual ~RTMPServer();
+
+    // allocated from the per thread slab pool
+    static void *operator new(size_t size);
+    static void operator delete(void *p, size_t size);
 public:
     virtual int32_t Handshake();
     virtual void SetSendTimeout(int64_t timeout_us);
@@ -19,7 +23,7 @@ public:
     virtual int SetPeerBandwidth(int bandwidth, int type);
     virtual int SetChunkSize(int chunk_size);
     virtual int ResponseConnectApp(rtmp::Request *req, const std::string &local_ip);
-    virtual int IdentifyClient(int stream_id, rtmp::ConnType &type, std::string &stream_name, double &duration);
+    virtual int IdentifyClient(int stream_id, rtmp::ConnType &type, std::string &stream_name, double &duration, double &start);
     virtual int StartFmlePublish(int stream_id);
     virtual int RecvMessage(rtmp::CommonMessage **pmsg);
     virtual void SetRecvBuffer(int buffer_size);
@@ -28,15 +32,23 @@ public:
     virtual int FMLEUnPublish(int stream_id, double unpublish_tid);
     virtual int StartPlay(int stream_id);
     virtual void SetAutoResponse(bool v);
+    virtual void SetZeroCopy(int threshold);
+    // reap the zerocopy completions, return true when any reaped
+    virtual bool ReapZeroCopy();
+    virtual void SetHeaderCompression(bool v);
+    virtual void SetAggregate(int max_size);
     virtual int SendAndFreeMessages(rtmp::SharedPtrMessage** msgs,
     int nb_msgs,
     int stream_id);
+    virtual int HandoffSize();
+    virtual int EncodeHandoff(BufferManager *manager);
+    virtual int DecodeHandoff(BufferManager *manager);
 
 protected:
     virtual int IdentiyFmlePublishClient(rtmp::FMLEStartPacket *pkt, rtmp::ConnType &type, std::string &stream_name);
-    virtual int IdentiyCreateStreamClient(rtmp::CreateStreamPacket *pkt, int stream_id, rtmp::ConnType &type, std::string &stream_name, double &duration);
+    virtual int IdentiyCreateStreamClient(rtmp::CreateStreamPacket *pkt, int stream_id, rtmp::ConnType &type, std::string &stream_name, double &duration, double &start);
     virtual int IdentiyFlashPublishClient(rtmp::PublishPacket *pkt, rtmp::ConnType &type, std::string &stream_name);
-    virtual int IdentifyPlayClient(rtmp::PlayPacket *pkt, rtmp::ConnType &type, std::string &stream_name, double &duration);
+    virtual int IdentifyPlayClient(rtmp::PlayPacket *pkt, rtmp::ConnType &type, std::string &stream_name, double &duration, double &start);
 
 private:
     IProtocolReaderWriter *rw_;
@@ -3,6 +3,7 @@
 #include <common/error.hpp>
 #include <common/st.hpp>
 #include <common/utils.hpp>
+#include <common/config.hpp>
 #include <app/rtmp_connection.hpp>
 
 #include <unistd.h>
@@ -43,7 +44,7 @@ int32_t RTMPStreamListener::Listen(const std::string &ip, int port)
     port_ = port;
 
     rs_freep(listener_);
-    listener_ = new TCPListener(this, ip, port);
+    listener_ = new TCPListener(this, ip, port, _config->GetWorkers() > 1 || _config->GetThreads() > 1);
 
     if ((ret = listener_->Listen()) != ERROR_SUCCESS)
     {
@@ -69,7 +70,69 @@ int32_t RTMPStreamListener::OnTCPClient(st_netfd_t stfd)
 }
 
 
-Server::Server()
+ConnectionReaper::ConnectionReaper() : cond_(nullptr), thread_(nullptr)
+{
+
+}
+
+ConnectionReaper::~ConnectionReaper()
+{
+    if (thread_)
+    {
+        thread_->Stop();
+        rs_freep(thread_);
+    }
+    if (cond_)
+    {
+        st_cond_destroy(cond_);
+    }
+}
+
+int32_t ConnectionReaper::Initialize()
+{
+    int32_t ret = ERROR_SUCCESS;
+
+    cond_ = st_cond_new();
+    thread_ = new internal::Thread("conn-reaper", this, 0, true);
+    if ((ret = thread_->Start()) != ERROR_SUCCESS)
+    {
+        rs_error("start connection reaper failed, ret=%d", ret);
+        return ret;
+    }
+
+    return ret;
+}
+
+void ConnectionReaper::Push(Connection *conn)
+{
+    zombies_.push_back(conn);
+    st_cond_signal(cond_);
+}
+
+int32_t ConnectionReaper::Cycle()
+{
+    int32_t ret = ERROR_SUCCESS;
+
+    if (zombies_.empty())
+    {
+        st_cond_wait(cond_);
+    }
+
+    std::vector<Connection *> zombies;
+    zombies.swap(zombies_);
+    for (size_t i = 0; i < zombies.size(); i++)
+    {
+        Connection *conn = zombies[i];
+        rs_freep(conn);
+    }
+
+    return ret;
+}
+
+// the reaper of the scheduler thread, created by InitializeST
+static thread_local ConnectionReaper *_reaper = nullptr;
+
+Server::Server() : worker_(nullptr)
 {
 
 }
@@ -91,6 +154,15 @@ int32_t Server::InitializeST()
     _context->GenerateID();
     rs_trace("rtmp server main cid=%d, pid=%d", _context->GetID(), ::getpid());
 
+    // warm up the stack cache of st, the connection storm creates coroutines without mmap
+    STPrewarmStacks(_config->GetStackPrewarm());
+
+    _reaper = new ConnectionReaper();
+    if ((ret = _reaper->Initialize()) != ERROR_SUCCESS)
+    {
+        return ret;
+    }
+
     return ret;
 }
 
@@ -99,9 +171,8 @@ int32_t Server::Initilaize()
     return 0;
 }
 
-int32_t Server::AcceptClient(ListenerType type, st_netfd_t stfd)
+int32_t Server::set_close_on_exec(st_netfd_t stfd)
 {
-
     int32_t ret = ERROR_SUCCESS;
 
     int32_t fd = st_netfd_fileno(stfd);
@@ -123,6 +194,19 @@ int32_t Server::AcceptClient(ListenerType type, st_netfd_t stfd)
         return ret;
     }
 
+    return ret;
+}
+
+int32_t Server::AcceptClient(ListenerType type, st_netfd_t stfd)
+{
+
+    int32_t ret = ERROR_SUCCESS;
+
+    if ((ret = set_close_on_exec(stfd)) != ERROR_SUCCESS)
+    {
+        return ret;
+    }
+
     Connection *conn = nullptr;
     if (type == ListenerType::RTMP)
     {
@@ -137,6 +221,50 @@ int32_t Server::AcceptClient(ListenerType type, st_netfd_t stfd)
     return ret;
 }
 
+int32_t Server::ResumeClient(ListenerType type, st_netfd_t stfd, const char *state, int size)
+{
+    int32_t ret = ERROR_SUCCESS;
+
+    if ((ret = set_close_on_exec(stfd)) != ERROR_SUCCESS)
+    {
+        STCloseFd(stfd);
+        return ret;
+    }
+
+    RTMPConnection *conn = nullptr;
+    if (type == ListenerType::RTMP)
+    {
+        conn = new RTMPConnection(this, stfd);
+    }
+
+    if (!conn)
+    {
+        ret = ERROR_SYSTEM_CLIENT_INVALID;
+        rs_error("resume client of unknown listener type=%d, ret=%d", (int)type, ret);
+        STCloseFd(stfd);
+        return ret;
+    }
+
+    conn->Resume(state, size);
+
+    if ((ret = conn->Start()) != ERROR_SUCCESS)
+    {
+        return ret;
+    }
+
+    return ret;
+}
+
+void Server::SetWorker(Worker *worker)
+{
+    worker_ = worker;
+}
+
+Worker *Server::GetWorker()
+{
+    return worker_;
+}
+
 int32_t Server::Listen()
 {
     int ret = ERROR_SUCCESS;
@@ -155,6 +283,10 @@ int32_t Server::ListenRTMP()
 
 void Server::OnRemove(Connection *conn)
 {
+    if (_reaper)
+    {
+        _reaper->Push(conn);
+    }
 }
 
 int Server::OnPublish(rtmp::Source *s, rtmp::Request *r)
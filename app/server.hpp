@@ -6,6 +6,7 @@
 #include <common/connection.hpp>
 #include <protocol/rtmp_source.hpp>
 #include <string>
+#include <vector>
 
 enum class ListenerType
 {
@@ -13,6 +14,7 @@ enum class ListenerType
 };
 
 class Server;
+class Worker;
 
 class IServerListener
 {
@@ -47,6 +49,28 @@ private:
     TCPListener *listener_;
 };
 
+/**
+ * the connection is removed in its own coroutine, which can not free itself, so the
+ * reaper of each scheduler thread frees the removed connections later.
+ */
+class ConnectionReaper : public internal::IThreadHandler
+{
+public:
+    ConnectionReaper();
+    virtual ~ConnectionReaper();
+
+public:
+    virtual int32_t Initialize();
+    virtual void Push(Connection *conn);
+    // internal::IThreadHandler
+    virtual int32_t Cycle() override;
+
+private:
+    std::vector<Connection *> zombies_;
+    st_cond_t cond_;
+    internal::Thread *thread_;
+};
+
 class Server: virtual public IConnectionManager,
               virtual public rtmp::ISourceHandler
 {
@@ -61,6 +85,9 @@ public:
     virtual int32_t Listen();
 
     virtual int32_t AcceptClient(ListenerType type ,st_netfd_t stfd);
+    virtual int32_t ResumeClient(ListenerType type, st_netfd_t stfd, const char *state, int size);
+    virtual void SetWorker(Worker *worker);
+    virtual Worker *GetWorker();
 
     virtual void OnRemove(Connection *conn) override;
     // rtmp::ISourceHandler
@@ -68,6 +95,10 @@ public:
     virtual int OnUnPublish(rtmp::Source *s, rtmp::Request *r) override;
 protected:
     virtual int32_t ListenRTMP();
+    virtual int32_t set_close_on_exec(st_netfd_t stfd);
+
+private:
+    Worker *worker_;
 };
 
 #endif
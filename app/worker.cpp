@@ -0,0 +1,211 @@
+#include <app/worker.hpp>
+#include <app/server.hpp>
+#include <common/error.hpp>
+#include <common/log.hpp>
+#include <common/st.hpp>
+#include <common/utils.hpp>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+static uint32_t stream_url_hash(const std::string &stream_url)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < stream_url.length(); i++)
+    {
+        hash ^= (uint8_t)stream_url[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+int32_t WorkerCreateChannels(int nb_workers, std::vector<int> &channels)
+{
+    int32_t ret = ERROR_SUCCESS;
+
+    for (int i = 0; i < nb_workers; i++)
+    {
+        int fds[2];
+        if (::socketpair(AF_UNIX, SOCK_DGRAM, 0, fds) == -1)
+        {
+            ret = ERROR_SYSTEM_WORKER_CHANNEL;
+            rs_error("create worker channel failed, index=%d, ret=%d", i, ret);
+            return ret;
+        }
+        channels.push_back(fds[0]);
+        channels.push_back(fds[1]);
+    }
+
+    return ret;
+}
+
+Worker::Worker(Server *server, int index, const std::vector<int> &channels) : server_(server),
+                                                                                index_(index),
+                                                                                channels_(channels),
+                                                                                stfd_(nullptr)
+{
+    nb_workers_ = (int)channels_.size() / 2;
+    buf_ = new char[RS_WORKER_HANDOFF_MAX];
+    thread_ = new internal::Thread("worker-channel", this, 0, true);
+}
+
+Worker::~Worker()
+{
+    thread_->Stop();
+    rs_freep(thread_);
+    STCloseFd(stfd_);
+    rs_freepa(buf_);
+}
+
+int32_t Worker::Initialize()
+{
+    int32_t ret = ERROR_SUCCESS;
+
+    // the recv channel of other workers are useless for us
+    for (int i = 0; i < nb_workers_; i++)
+    {
+        if (i != index_)
+        {
+            ::close(channels_[i * 2 + 1]);
+            channels_[i * 2 + 1] = -1;
+        }
+    }
+
+    if ((stfd_ = st_netfd_open_socket(channels_[index_ * 2 + 1])) == nullptr)
+    {
+        ret = ERROR_ST_OPEN_SOCKET;
+        rs_error("open worker channel failed, index=%d, ret=%d", index_, ret);
+        return ret;
+    }
+
+    if ((ret = thread_->Start()) != ERROR_SUCCESS)
+    {
+        rs_error("start worker channel thread failed, index=%d, ret=%d", index_, ret);
+        return ret;
+    }
+
+    rs_trace("worker %d/%d channel ready", index_, nb_workers_);
+    return ret;
+}
+
+int Worker::GetIndex()
+{
+    return index_;
+}
+
+int Worker::GetOwner(const std::string &stream_url)
+{
+    if (nb_workers_ <= 1)
+    {
+        return index_;
+    }
+    return (int)(stream_url_hash(stream_url) % nb_workers_);
+}
+
+int32_t Worker::Handoff(int owner, int fd, char *state, int size)
+{
+    int32_t ret = ERROR_SUCCESS;
+
+    if (owner < 0 || owner >= nb_workers_ || owner == index_ || size > RS_WORKER_HANDOFF_MAX)
+    {
+        ret = ERROR_SYSTEM_WORKER_HANDOFF;
+        rs_error("invalid handoff, owner=%d, size=%d, ret=%d", owner, size, ret);
+        return ret;
+    }
+
+    iovec iov;
+    iov.iov_base = state;
+    iov.iov_len = size;
+
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(control, 0, sizeof(control));
+
+    msghdr msg;
+    memset(&msg, 0, sizeof(msghdr));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    // never block the st loop, the caller serves the client itself when the channel is full
+    if (::sendmsg(channels_[owner * 2], &msg, MSG_DONTWAIT) != size)
+    {
+        ret = ERROR_SYSTEM_WORKER_HANDOFF;
+        rs_warn("handoff fd=%d to worker %d failed, errno=%d, ret=%d", fd, owner, errno, ret);
+        return ret;
+    }
+
+    rs_trace("handoff fd=%d to worker %d, size=%d", fd, owner, size);
+    return ret;
+}
+
+int32_t Worker::Cycle()
+{
+    int32_t ret = ERROR_SUCCESS;
+
+    iovec iov;
+    iov.iov_base = buf_;
+    iov.iov_len = RS_WORKER_HANDOFF_MAX;
+
+    char control[CMSG_SPACE(sizeof(int))];
+
+    msghdr msg;
+    memset(&msg, 0, sizeof(msghdr));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    int nread = st_recvmsg(stfd_, &msg, 0, ST_UTIME_NO_TIMEOUT);
+    if (nread <= 0)
+    {
+        if (errno != EINTR)
+        {
+            ret = ERROR_SYSTEM_WORKER_CHANNEL;
+            rs_error("recv from worker channel failed, errno=%d, ret=%d", errno, ret);
+        }
+        return ret;
+    }
+
+    int fd = -1;
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+    {
+        memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+
+    if (fd < 0 || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)))
+    {
+        ret = ERROR_SYSTEM_WORKER_HANDOFF;
+        rs_error("invalid handoff message, fd=%d, flags=%#x, ret=%d", fd, msg.msg_flags, ret);
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+        return ret;
+    }
+
+    st_netfd_t client_stfd = st_netfd_open_socket(fd);
+    if (client_stfd == nullptr)
+    {
+        ret = ERROR_ST_OPEN_SOCKET;
+        rs_error("open handoff client failed, fd=%d, ret=%d", fd, ret);
+        ::close(fd);
+        return ret;
+    }
+
+    if ((ret = server_->ResumeClient(ListenerType::RTMP, client_stfd, buf_, nread)) != ERROR_SUCCESS)
+    {
+        rs_error("resume handoff client failed, fd=%d, ret=%d", fd, ret);
+        return ret;
+    }
+
+    return ret;
+}
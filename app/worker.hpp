@@ -0,0 +1,49 @@
+#ifndef RS_WORKER_HPP
+#define RS_WORKER_HPP
+
+#include <common/core.hpp>
+#include <common/thread.hpp>
+
+#include <string>
+#include <vector>
+
+// max bytes of the state passed with the client fd
+#define RS_WORKER_HANDOFF_MAX 65536
+
+class Server;
+
+/**
+ * the worker process of the reuseport mode. every stream is owned by one worker by the
+ * hash of the stream url, the client accepted by other worker is passed to the owner by
+ * the unix socket channel with the fd and the identified state, so the publisher and
+ * players of a stream always meet in the same process.
+ *
+ * channels are the [send, recv] socketpair of each worker, created by master before fork.
+ */
+class Worker : public internal::IThreadHandler
+{
+public:
+    Worker(Server *server, int index, const std::vector<int> &channels);
+    virtual ~Worker();
+
+public:
+    virtual int32_t Initialize();
+    virtual int GetIndex();
+    virtual int GetOwner(const std::string &stream_url);
+    virtual int32_t Handoff(int owner, int fd, char *state, int size);
+    // internal::IThreadHandler
+    virtual int32_t Cycle() override;
+
+private:
+    Server *server_;
+    int index_;
+    int nb_workers_;
+    std::vector<int> channels_;
+    st_netfd_t stfd_;
+    char *buf_;
+    internal::Thread *thread_;
+};
+
+extern int32_t WorkerCreateChannels(int nb_workers, std::vector<int> &channels);
+
+#endif
@@ -0,0 +1,327 @@
+#include <common/aio.hpp>
+#include <common/error.hpp>
+#include <common/log.hpp>
+#include <common/pool.hpp>
+#include <common/st.hpp>
+#include <common/utils.hpp>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void set_nonblock(int fd)
+{
+    int flags = ::fcntl(fd, F_GETFL, 0);
+    ::fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+AsyncFileIO::AsyncFileIO()
+{
+    queue_depth_ = 0;
+    next_thread_ = 0;
+    done_[0] = done_[1] = -1;
+    done_stfd_ = nullptr;
+    thread_ = nullptr;
+}
+
+AsyncFileIO::~AsyncFileIO()
+{
+    // the io threads live as long as the process
+    rs_freep(thread_);
+}
+
+int32_t AsyncFileIO::Initialize(int nb_threads, int queue_depth)
+{
+    int32_t ret = ERROR_SUCCESS;
+
+    if (nb_threads <= 0)
+    {
+        rs_trace("aio disabled, write files in st thread");
+        return ret;
+    }
+
+    if (::pipe(done_) < 0)
+    {
+        ret = ERROR_SYSTEM_CREATE_PIPE;
+        rs_error("create aio done pipe failed, ret=%d", ret);
+        return ret;
+    }
+    set_nonblock(done_[1]);
+
+    if ((done_stfd_ = st_netfd_open(done_[0])) == nullptr)
+    {
+        ret = ERROR_ST_OPEN_SOCKET;
+        rs_error("open aio done pipe failed, ret=%d", ret);
+        return ret;
+    }
+
+    queue_depth_ = queue_depth;
+    for (int i = 0; i < nb_threads; i++)
+    {
+        IOThread *t = new IOThread;
+        t->requests = new SPSCQueue<AioJob *>(queue_depth);
+        t->completions = new SPSCQueue<AioJob *>(queue_depth);
+        t->sleeping.store(false);
+        t->done_fd = done_[1];
+        t->inflight = 0;
+
+        if (::pipe(t->wakeup) < 0)
+        {
+            ret = ERROR_SYSTEM_CREATE_PIPE;
+            rs_error("create aio wakeup pipe failed, ret=%d", ret);
+            return ret;
+        }
+        set_nonblock(t->wakeup[1]);
+
+        if (::pthread_create(&t->tid, nullptr, io_thread, t) != 0)
+        {
+            ret = ERROR_SYSTEM_AIO_THREAD;
+            rs_error("create aio thread %d failed, ret=%d", i, ret);
+            return ret;
+        }
+        ::pthread_detach(t->tid);
+        threads_.push_back(t);
+    }
+
+    thread_ = new internal::Thread("aio", this, 0, false);
+    if ((ret = thread_->Start()) != ERROR_SUCCESS)
+    {
+        rs_error("start aio completion thread failed, ret=%d", ret);
+        return ret;
+    }
+
+    rs_trace("aio started, threads=%d, queue_depth=%d", nb_threads, queue_depth);
+    return ret;
+}
+
+AioFile *AsyncFileIO::Open(const std::string &path, int flags, bool append)
+{
+    AioFile *file = new AioFile;
+    file->path = path;
+    file->flags = flags;
+    file->append = append;
+    file->fd = -1;
+    file->base = 0;
+    file->opened = false;
+    file->thread = threads_.empty() ? -1 : (next_thread_++ % (int)threads_.size());
+    file->pending = 0;
+    file->error = ERROR_SUCCESS;
+    file->closing = false;
+    return file;
+}
+
+bool AsyncFileIO::Busy(AioFile *file)
+{
+    if (file->thread < 0)
+    {
+        return false;
+    }
+    if (!file->opened)
+    {
+        return true;
+    }
+    // keep a quarter for the headers and metadata which are not droppable
+    return threads_[file->thread]->inflight >= queue_depth_ * 3 / 4;
+}
+
+int32_t AsyncFileIO::Submit(AioJob *job)
+{
+    int32_t ret = ERROR_SUCCESS;
+
+    AioFile *file = job->file;
+    if (file->thread < 0)
+    {
+        file->pending++;
+        execute(job);
+        complete(job);
+        return ret;
+    }
+
+    IOThread *t = threads_[file->thread];
+    if (t->inflight >= queue_depth_ || !t->requests->Push(job))
+    {
+        ret = ERROR_SYSTEM_FILE_BUSY;
+        rs_warn("aio queue full, file=%s, inflight=%d, ret=%d", file->path.c_str(), t->inflight, ret);
+        return ret;
+    }
+    t->inflight++;
+    file->pending++;
+
+    // pairs with the fence of io thread, one of us must see the other
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (t->sleeping.load())
+    {
+        char c = 0;
+        ::write(t->wakeup[1], &c, 1);
+    }
+
+    return ret;
+}
+
+int32_t AsyncFileIO::Cycle()
+{
+    int32_t ret = ERROR_SUCCESS;
+
+    char buf[64];
+    if (st_read(done_stfd_, buf, sizeof(buf), ST_UTIME_NO_TIMEOUT) <= 0)
+    {
+        return ret;
+    }
+
+    for (size_t i = 0; i < threads_.size(); i++)
+    {
+        IOThread *t = threads_[i];
+        AioJob *job = nullptr;
+        while (t->completions->Pop(job))
+        {
+            t->inflight--;
+            complete(job);
+        }
+    }
+
+    return ret;
+}
+
+void *AsyncFileIO::io_thread(void *arg)
+{
+    IOThread *t = (IOThread *)arg;
+
+    while (true)
+    {
+        AioJob *job = nullptr;
+        if (!t->requests->Pop(job))
+        {
+            // the producer wakes us up when it sees sleeping after push
+            t->sleeping.store(true);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!t->requests->Pop(job))
+            {
+                char c;
+                ::read(t->wakeup[0], &c, 1);
+                t->sleeping.store(false);
+                continue;
+            }
+            t->sleeping.store(false);
+        }
+
+        execute(job);
+        // never full, the jobs in flight are bounded by the queue depth
+        t->completions->Push(job);
+
+        // notify the st thread once for a batch
+        if (t->requests->Empty())
+        {
+            char c = 0;
+            ::write(t->done_fd, &c, 1);
+        }
+    }
+
+    return nullptr;
+}
+
+void AsyncFileIO::execute(AioJob *job)
+{
+    job->err = 0;
+    AioFile *file = job->file;
+
+    if (job->type == AioType::OPEN)
+    {
+        mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH;
+        if ((file->fd = ::open(file->path.c_str(), file->flags, mode)) < 0)
+        {
+            job->err = errno;
+            return;
+        }
+        // the writes are positional, append from the end
+        file->base = file->append ? ::lseek(file->fd, 0, SEEK_END) : 0;
+        return;
+    }
+
+    if (job->type == AioType::CLOSE)
+    {
+        if (file->fd >= 0 && ::close(file->fd) < 0)
+        {
+            job->err = errno;
+        }
+        return;
+    }
+
+    // the open failed, reported by the open job
+    if (file->fd < 0)
+    {
+        job->err = EBADF;
+        return;
+    }
+
+    int64_t offset = file->base + job->offset;
+    char *p = job->buf;
+    int left = job->size;
+    while (left > 0)
+    {
+        ssize_t nwrite = ::pwrite(file->fd, p, left, (off_t)offset);
+        if (nwrite < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            job->err = errno;
+            return;
+        }
+        p += nwrite;
+        left -= (int)nwrite;
+        offset += nwrite;
+    }
+}
+
+void AsyncFileIO::complete(AioJob *job)
+{
+    AioFile *file = job->file;
+    file->pending--;
+
+    if (job->type == AioType::OPEN)
+    {
+        file->opened = true;
+    }
+
+    if (job->err)
+    {
+        int ret = ERROR_SYSTEM_FILE_WRITE;
+        const char *op = "write";
+        if (job->type == AioType::CLOSE)
+        {
+            ret = ERROR_SYSTEM_FILE_CLOSE;
+            op = "close";
+        }
+        else if (job->type == AioType::OPEN)
+        {
+            ret = ERROR_SYSTEM_FILE_OPENE;
+            op = "open";
+        }
+        rs_error("aio %s file %s failed, errno=%d, ret=%d", op, file->path.c_str(), job->err, ret);
+        if (file->error == ERROR_SUCCESS)
+        {
+            file->error = ret;
+        }
+    }
+
+    if (job->buf)
+    {
+        BufferPool::Free(job->buf);
+    }
+
+    // the close is the last job of the file
+    if (job->type == AioType::CLOSE)
+    {
+        rs_freep(file);
+    }
+    else if (file->closing && file->pending == 0)
+    {
+        if (file->fd >= 0)
+        {
+            ::close(file->fd);
+        }
+        rs_freep(file);
+    }
+    rs_freep(job);
+}
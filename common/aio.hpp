@@ -0,0 +1,109 @@
+#ifndef RS_AIO_HPP
+#define RS_AIO_HPP
+
+#include <common/core.hpp>
+#include <common/queue.hpp>
+#include <common/thread.hpp>
+
+#include <pthread.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+enum class AioType
+{
+    WRITE = 0,
+    CLOSE = 1,
+    OPEN = 2,
+};
+
+/**
+ * the file written by the io threads. only the st thread touches the state,
+ * the io threads use the fd of the job. the fd and base are set by the io thread
+ * of the open job, before any write of the file, and read by the st thread only
+ * after the open completed.
+ */
+struct AioFile
+{
+    std::string path;
+    int flags;
+    // append to the end, the base is the file size when opened
+    bool append;
+    int fd;
+    int64_t base;
+    // the open job completed
+    bool opened;
+    int thread;
+    // jobs submitted but not completed
+    int pending;
+    // the first failed write, reported to the next write
+    int error;
+    // the close job is not queued, closed by the st thread when the pending jobs done
+    bool closing;
+};
+
+struct AioJob
+{
+    AioType type;
+    AioFile *file;
+    int64_t offset;
+    // from BufferPool, freed by the st thread when completed
+    char *buf;
+    int size;
+    int err;
+};
+
+/**
+ * the io thread pool of the file writes, so a slow disk never blocks the st loop.
+ * jobs of a file always go to the same io thread, by the lock free spsc queues, and the
+ * completions come back to the st thread by the queues and a pipe.
+ * the jobs in flight of each io thread are bounded by the queue depth, the writer should
+ * check Busy() to drop the droppable data, and Submit fails when full.
+ */
+class AsyncFileIO : public internal::IThreadHandler
+{
+public:
+    AsyncFileIO();
+    virtual ~AsyncFileIO();
+
+public:
+    virtual int32_t Initialize(int nb_threads, int queue_depth);
+    // the file is opened by the open job, the writes queued after it
+    virtual AioFile *Open(const std::string &path, int flags, bool append);
+    virtual int32_t Submit(AioJob *job);
+    // over the high water mark of the io thread of the file, or not opened yet
+    virtual bool Busy(AioFile *file);
+    // internal::IThreadHandler
+    virtual int32_t Cycle() override;
+
+private:
+    struct IOThread
+    {
+        pthread_t tid;
+        SPSCQueue<AioJob *> *requests;
+        SPSCQueue<AioJob *> *completions;
+        // wakeup the io thread when it sleeps
+        int wakeup[2];
+        std::atomic<bool> sleeping;
+        int done_fd;
+        // by the st thread only
+        int inflight;
+    };
+
+    static void *io_thread(void *arg);
+    static void execute(AioJob *job);
+    void complete(AioJob *job);
+
+private:
+    std::vector<IOThread *> threads_;
+    int queue_depth_;
+    int next_thread_;
+    int done_[2];
+    st_netfd_t done_stfd_;
+    internal::Thread *thread_;
+};
+
+// each scheduler thread has its own io threads
+extern thread_local AsyncFileIO *_aio;
+
+#endif
@@ -3,10 +3,17 @@
 #include <common/log.hpp>
 #include <common/utils.hpp>
 
+#include <vector>
+
 // default recv buffer size 128kb
 #define RS_DEFAULT_RECV_BUFFER_SIZE 131072
 // socket max buffer size 256kb
 #define RS_MAX_SOCKET_BUFFER_SIZE 262144
+// default recv buffers cached by each thread, for the connection storms
+#define RS_RECV_BUFFER_CACHE_MAX 1024
+
+// only the buffers of default size are cached, the enlarged ones are freed
+static thread_local std::vector<char *> _recv_buffer_cache;
 
 BufferManager::BufferManager() : buf_(nullptr),
                    ptr_(nullptr),
@@ -42,103 +49,6 @@ int32_t BufferManager::Initialize(char *b, int32_t nb)
     return ret;
 }
 
-char* BufferManager::Data()
-{
-    return buf_;
-}
-
-int32_t BufferManager::Size()
-{
-    return size_;
-}
-
-int32_t BufferManager::Pos()
-{
-    return int32_t(ptr_ - buf_);
-}
-
-bool BufferManager::Empty()
-{
-    return !buf_ || (ptr_ >= buf_ + size_);
-}
-
-bool BufferManager::Require(int32_t required_size)
-{
-    rs_assert(required_size >= 0);
-    // rs_info("required size %d, %d, %d, %d", required_size, size_, ptr_ - buf_);
-    return required_size <= size_ - (ptr_ - buf_);
-}
-
-void BufferManager::Skip(int32_t size)
-{
-    rs_assert(ptr_);
-    ptr_ += size;
-}
-
-int8_t BufferManager::Read1Bytes()
-{
-    rs_assert(Require(1));
-    return (int8_t)*ptr_++;
-}
-
-int16_t BufferManager::Read2Bytes()
-{
-    rs_assert(Require(2));
-    int16_t value;
-    char *pp = (char *)&value;
-
-    pp[1] = *ptr_++;
-    pp[0] = *ptr_++;
-
-    return value;
-}
-
-int32_t BufferManager::Read3Bytes()
-{
-    rs_assert(Require(3));
-    int32_t value = 0;
-    char *pp = (char *)&value;
-
-    pp[2] = *ptr_++;
-    pp[1] = *ptr_++;
-    pp[0] = *ptr_++;
-    // rs_warn("Read3Bytes, %x, %x, %x", pp[2], pp[1], pp[0]);
-
-    return value;
-}
-
-int32_t BufferManager::Read4Bytes()
-{
-    rs_assert(Require(4));
-    int32_t value;
-    char *pp = (char *)&value;
-
-    pp[3] = *ptr_++;
-    pp[2] = *ptr_++;
-    pp[1] = *ptr_++;
-    pp[0] = *ptr_++;
-
-    return value;
-}
-
-int64_t BufferManager::Read8Bytes()
-{
-    rs_assert(Require(8));
-    int64_t value;
-    char *pp = (char *)&value;
-
-    pp[7] = *ptr_++;
-    pp[6] = *ptr_++;
-    pp[5] = *ptr_++;
-    pp[4] = *ptr_++;
-    pp[3] = *ptr_++;
-    pp[2] = *ptr_++;
-    pp[1] = *ptr_++;
-    pp[0] = *ptr_++;
-
-    return value;
-}
-
 std::string BufferManager::ReadString(int32_t len)
 {
     rs_assert(Require(len));
@@ -157,55 +67,6 @@ void BufferManager::ReadBytes(char *data, int32_t size)
     ptr_ += size;
 }
 
-void BufferManager::Write1Bytes(int8_t value)
-{
-    rs_assert(Require(1));
-    *ptr_++ = value;
-}
-
-void BufferManager::Write2Bytes(int16_t value)
-{
-    rs_assert(Require(2));
-    char *pp = (char *)&value;
-    *ptr_++ = pp[1];
-    *ptr_++ = pp[0];
-}
-
-
-void BufferManager::Write3Bytes(int32_t value)
-{
-    rs_assert(Require(3));
-    char *pp = (char *)&value;
-    *ptr_++ = pp[2];
-    *ptr_++ = pp[1];
-    *ptr_++ = pp[0];
-}
-
-void BufferManager::Write4Bytes(int32_t value)
-{
-    rs_assert(Require(4));
-    char *pp = (char *)&value;
-    rs_verbose("write4Bytes:%c, %c, %c, %c", pp[0], pp[1], pp[2], pp[3]);
-    *ptr_++ = pp[3];
-    *ptr_++ = pp[2];
-    *ptr_++ = pp[1];
-    *ptr_++ = pp[0];
-}
-
-void BufferManager::Write8Bytes(int64_t value)
-{
-    rs_assert(Require(8));
-    char *pp = (char *)&value;
-    *ptr_++ = pp[7];
-    *ptr_++ = pp[6];
-    *ptr_++ = pp[5];
-    *ptr_++ = pp[4];
-    *ptr_++ = pp[3];
-    *ptr_++ = pp[2];
-    *ptr_++ = pp[1];
-    *ptr_++ = pp[0];
-}
-
 void BufferManager::WriteString(const std::string &value)
 {
     rs_assert(Require(value.length()));
@@ -267,13 +128,28 @@ FastBuffer::FastBuffer() : merge_read_(false),
                            mr_handler_(nullptr)
 {
     capacity_ = RS_DEFAULT_RECV_BUFFER_SIZE;
-    buf_ = (char *)malloc(capacity_);
+    if (!_recv_buffer_cache.empty())
+    {
+        buf_ = _recv_buffer_cache.back();
+        _recv_buffer_cache.pop_back();
+    }
+    else
+    {
+        buf_ = (char *)malloc(capacity_);
+    }
     start_ = end_ = buf_;
 }
 
 FastBuffer::~FastBuffer()
 {
-    free(buf_);
+    if (capacity_ == RS_DEFAULT_RECV_BUFFER_SIZE && _recv_buffer_cache.size() < RS_RECV_BUFFER_CACHE_MAX)
+    {
+        _recv_buffer_cache.push_back(buf_);
+    }
+    else
+    {
+        free(buf_);
+    }
     buf_ = nullptr;
 }
 
@@ -307,6 +183,7 @@ void FastBuffer::SetBuffer(int32_t buffer_size)
     int32_t size = Size();
 
     buf_ = (char *)realloc(buf_, buffer_size);
+    capacity_ = buffer_size;
     start_ = buf_ + start_pos;
     end_ = start_ + size;
 }
@@ -386,6 +263,84 @@ int32_t FastBuffer::Grow(IBufferReader *r, int required_size)
     return ret;
 }
 
+int32_t FastBuffer::ReadInto(IBufferReader *r, char *dst, int32_t size, int32_t *pcopied, int32_t *pnread)
+{
+    rs_assert(size >= 0);
+
+    int32_t ret = ERROR_SUCCESS;
+
+    int32_t copied = rs_min(Size(), size);
+    memcpy(dst, start_, copied);
+    start_ += copied;
+    *pcopied = copied;
+    *pnread = copied;
+
+    if (copied == size)
+    {
+        return ret;
+    }
+
+    // all consumed, the whole buffer is free for the bytes after dst
+    start_ = end_ = buf_;
+
+    int32_t left = size - copied;
+    while (left > 0)
+    {
+        iovec iovs[2];
+        iovs[0].iov_base = dst + size - left;
+        iovs[0].iov_len = left;
+        iovs[1].iov_base = end_;
+        iovs[1].iov_len = buf_ + capacity_ - end_;
+
+        ssize_t nread;
+        if ((ret = r->ReadEv(iovs, 2, &nread)) != ERROR_SUCCESS)
+        {
+            return ret;
+        }
+        if (merge_read_ && mr_handler_)
+        {
+            mr_handler_->OnRead(nread);
+        }
+
+        rs_assert(int32_t(nread) > 0);
+        if (nread <= left)
+        {
+            left -= nread;
+        }
+        else
+        {
+            end_ += nread - left;
+            left = 0;
+        }
+        *pnread = size - left;
+    }
+
+    return ret;
+}
+
+int32_t FastBuffer::Append(const char *data, int32_t size)
+{
+    int32_t ret = ERROR_SUCCESS;
+
+    int32_t used_space = Size();
+    if (buf_ + capacity_ - end_ < size && start_ > buf_)
+    {
+        memmove(buf_, start_, used_space);
+        start_ = buf_;
+        end_ = start_ + used_space;
+    }
+
+    if (buf_ + capacity_ - end_ < size)
+    {
+        ret = ERROR_READER_BUFFER_OVERFLOW;
+        rs_error("fast buffer overflow, size=%d, used=%d, capacity=%d, ret=%d", size, used_space, capacity_, ret);
+        return ret;
+    }
+
+    memcpy(end_, data, size);
+    end_ += size;
+    return ret;
+}
 
 void FastBuffer::SetMergeReadHandler(bool enable, IMergeReadHandler *mr_handler)
 {
@@ -2,42 +2,48 @@
 #define RS_BUFFER_HPP
 #include <common/core.hpp>
 #include <common/io.hpp>
+#include <common/bytes.hpp>
 #include <string>
 
+// the adapter of ByteReader and ByteWriter, asserts the bounds per field
 class BufferManager
 {
 public:
     BufferManager();
-    virtual ~BufferManager();
+    ~BufferManager();
 
 public:
 
-    virtual int32_t Initialize(char *b, int32_t nb);
+    int32_t Initialize(char *b, int32_t nb);
 
-    virtual char *Data();
-    virtual int32_t Size();
-    virtual int32_t Pos();
-    virtual bool Empty();
-    virtual bool Require(int32_t required_size);
-    virtual void Skip(int32_t size);
+    inline char *Data() { return buf_; }
+    inline int32_t Size() { return size_; }
+    inline int32_t Pos() { return int32_t(ptr_ - buf_); }
+    inline bool Empty() { return !buf_ || (ptr_ >= buf_ + size_); }
+    inline bool Require(int32_t required_size)
+    {
+        assert(required_size >= 0);
+        return required_size <= size_ - (ptr_ - buf_);
+    }
+    inline void Skip(int32_t size) { ptr_ += size; }
 
     // read
-    virtual int8_t Read1Bytes();
-    virtual int16_t Read2Bytes();
-    virtual int32_t Read3Bytes();
-    virtual int32_t Read4Bytes();
-    virtual int64_t Read8Bytes();
-    virtual std::string ReadString(int32_t len);
-    virtual void ReadBytes(char *data, int32_t size);
+    inline int8_t Read1Bytes() { assert(Require(1)); return (int8_t)*ptr_++; }
+    inline int16_t Read2Bytes() { assert(Require(2)); int16_t v = (int16_t)bytes::Read2(ptr_); ptr_ += 2; return v; }
+    inline int32_t Read3Bytes() { assert(Require(3)); int32_t v = (int32_t)bytes::Read3(ptr_); ptr_ += 3; return v; }
+    inline int32_t Read4Bytes() { assert(Require(4)); int32_t v = (int32_t)bytes::Read4(ptr_); ptr_ += 4; return v; }
+    inline int64_t Read8Bytes() { assert(Require(8)); int64_t v = (int64_t)bytes::Read8(ptr_); ptr_ += 8; return v; }
+    std::string ReadString(int32_t len);
+    void ReadBytes(char *data, int32_t size);
 
     // write
-    virtual void Write1Bytes(int8_t value);
-    virtual void Write2Bytes(int16_t value);
-    virtual void Write3Bytes(int32_t value);
-    virtual void Write4Bytes(int32_t value);
-    virtual void Write8Bytes(int64_t value);
-    virtual void WriteString(const std::string &value);
-    virtual void WriteBytes(char *data, int32_t size);
+    inline void Write1Bytes(int8_t value) { assert(Require(1)); *ptr_++ = value; }
+    inline void Write2Bytes(int16_t value) { assert(Require(2)); bytes::Write2(ptr_, (uint16_t)value); ptr_ += 2; }
+    inline void Write3Bytes(int32_t value) { assert(Require(3)); bytes::Write3(ptr_, (uint32_t)value); ptr_ += 3; }
+    inline void Write4Bytes(int32_t value) { assert(Require(4)); bytes::Write4(ptr_, (uint32_t)value); ptr_ += 4; }
+    inline void Write8Bytes(int64_t value) { assert(Require(8)); bytes::Write8(ptr_, (uint64_t)value); ptr_ += 8; }
+    void WriteString(const std::string &value);
+    void WriteBytes(char *data, int32_t size);
 
 private:
     char *buf_;
@@ -75,6 +81,11 @@ public:
     virtual char *ReadSlice(int32_t size);
     virtual void Skip(int32_t size);
     virtual int32_t Grow(IBufferReader *r, int32_t required_size);
+    // move size bytes to dst, the buffered bytes are copied and the others are read to
+    // dst directly, with the following bytes to the buffer in the same readv.
+    // the pcopied is the bytes copied from buffer, the pnread is the bytes moved to dst
+    virtual int32_t ReadInto(IBufferReader *r, char *dst, int32_t size, int32_t *pcopied, int32_t *pnread);
+    virtual int32_t Append(const char *data, int32_t size);
     virtual void SetMergeReadHandler(bool enable, IMergeReadHandler *mr_handler);
 
 private:
@@ -0,0 +1,126 @@
+#ifndef RS_BYTES_HPP
+#define RS_BYTES_HPP
+
+#include <common/core.hpp>
+
+#include <string.h>
+
+/**
+ * the big-endian codec of the network byte order, by one load or store of the host word
+ * and the bswap, instead of assembling byte by byte.
+ * the reader and writer never check the bounds per field, the caller requires the
+ * block of fields once, then reads or writes them unchecked.
+ */
+namespace bytes
+{
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+inline uint16_t ToBE16(uint16_t v) { return __builtin_bswap16(v); }
+inline uint32_t ToBE32(uint32_t v) { return __builtin_bswap32(v); }
+inline uint64_t ToBE64(uint64_t v) { return __builtin_bswap64(v); }
+#else
+inline uint16_t ToBE16(uint16_t v) { return v; }
+inline uint32_t ToBE32(uint32_t v) { return v; }
+inline uint64_t ToBE64(uint64_t v) { return v; }
+#endif
+
+inline uint16_t Read2(const char *p)
+{
+    uint16_t v;
+    memcpy(&v, p, 2);
+    return ToBE16(v);
+}
+
+inline uint32_t Read3(const char *p)
+{
+    return ((uint32_t)(uint8_t)p[0] << 16) | Read2(p + 1);
+}
+
+inline uint32_t Read4(const char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return ToBE32(v);
+}
+
+inline uint64_t Read8(const char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return ToBE64(v);
+}
+
+inline void Write2(char *p, uint16_t v)
+{
+    v = ToBE16(v);
+    memcpy(p, &v, 2);
+}
+
+inline void Write3(char *p, uint32_t v)
+{
+    p[0] = (char)(v >> 16);
+    Write2(p + 1, (uint16_t)v);
+}
+
+inline void Write4(char *p, uint32_t v)
+{
+    v = ToBE32(v);
+    memcpy(p, &v, 4);
+}
+
+inline void Write8(char *p, uint64_t v)
+{
+    v = ToBE64(v);
+    memcpy(p, &v, 8);
+}
+
+} // namespace bytes
+
+class ByteReader
+{
+public:
+    ByteReader(const char *b, int32_t nb) : ptr_(b), end_(b + nb) {}
+
+public:
+    inline bool Require(int32_t required_size) { return required_size >= 0 && required_size <= end_ - ptr_; }
+    inline int32_t Left() { return (int32_t)(end_ - ptr_); }
+    inline const char *Ptr() { return ptr_; }
+    inline void Skip(int32_t size) { ptr_ += size; }
+
+    // unchecked, the caller requires the bytes
+    inline uint8_t Read1() { return (uint8_t)*ptr_++; }
+    inline uint16_t Read2() { uint16_t v = bytes::Read2(ptr_); ptr_ += 2; return v; }
+    inline uint32_t Read3() { uint32_t v = bytes::Read3(ptr_); ptr_ += 3; return v; }
+    inline uint32_t Read4() { uint32_t v = bytes::Read4(ptr_); ptr_ += 4; return v; }
+    inline uint64_t Read8() { uint64_t v = bytes::Read8(ptr_); ptr_ += 8; return v; }
+
+private:
+    const char *ptr_;
+    const char *end_;
+};
+
+class ByteWriter
+{
+public:
+    ByteWriter(char *b, int32_t nb) : ptr_(b), end_(b + nb) {}
+
+public:
+    inline bool Require(int32_t required_size) { return required_size >= 0 && required_size <= end_ - ptr_; }
+    inline int32_t Left() { return (int32_t)(end_ - ptr_); }
+    inline char *Ptr() { return ptr_; }
+    inline void Skip(int32_t size) { ptr_ += size; }
+
+    // unchecked, the caller requires the bytes
+    inline void Write1(uint8_t v) { *ptr_++ = (char)v; }
+    inline void Write2(uint16_t v) { bytes::Write2(ptr_, v); ptr_ += 2; }
+    inline void Write3(uint32_t v) { bytes::Write3(ptr_, v); ptr_ += 3; }
+    inline void Write4(uint32_t v) { bytes::Write4(ptr_, v); ptr_ += 4; }
+    inline void Write8(uint64_t v) { bytes::Write8(ptr_, v); ptr_ += 8; }
+    inline void WriteBytes(const char *data, int32_t size) { memcpy(ptr_, data, size); ptr_ += size; }
+
+private:
+    char *ptr_;
+    char *end_;
+};
+
+#endif
@@ -0,0 +1,154 @@
+#include <common/clock.hpp>
+#include <common/error.hpp>
+#include <common/log.hpp>
+#include <common/utils.hpp>
+
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+Clock::Clock() : utc_(false),
+                 interval_us_(0),
+                 started_(false),
+                 steady_us_(0),
+                 sequence_(0),
+                 wall_us_(0),
+                 date_sec_(-1)
+{
+    date_[0] = 0;
+}
+
+Clock::~Clock()
+{
+}
+
+int32_t Clock::Initialize(int interval_us, bool utc)
+{
+    int32_t ret = ERROR_SUCCESS;
+
+    if (interval_us <= 0 || started_)
+    {
+        return ret;
+    }
+
+    utc_ = utc;
+    interval_us_ = interval_us;
+    update();
+
+    // the thread is never stopped, like the clock
+    pthread_t tid;
+    if (::pthread_create(&tid, nullptr, Clock::update_thread, this) != 0)
+    {
+        ret = ERROR_SYSTEM_CLOCK_THREAD;
+        rs_error("create clock thread failed, ret=%d", ret);
+        return ret;
+    }
+    ::pthread_detach(tid);
+
+    started_ = true;
+    rs_trace("coarse clock started, interval=%dus", interval_us_);
+    return ret;
+}
+
+int64_t Clock::SteadyMS()
+{
+    return SteadyUS() / 1000;
+}
+
+int64_t Clock::SteadyUS()
+{
+    if (!started_.load(std::memory_order_relaxed))
+    {
+        return Utils::GetSteadyMicroSeconds();
+    }
+    return steady_us_.load(std::memory_order_relaxed);
+}
+
+int64_t Clock::WallUS()
+{
+    if (!started_.load(std::memory_order_relaxed))
+    {
+        timeval tv;
+        gettimeofday(&tv, nullptr);
+        return tv.tv_sec * 1000000LL + tv.tv_usec;
+    }
+    return wall_us_.load(std::memory_order_relaxed);
+}
+
+int Clock::FormatDate(char *buf, int size)
+{
+    char date[RS_CLOCK_DATE_SIZE];
+    int64_t wall_us = 0;
+
+    if (!started_.load(std::memory_order_acquire))
+    {
+        wall_us = WallUS();
+        format_second(wall_us / 1000000, utc_, date, sizeof(date));
+    }
+    else
+    {
+        // retry when the update thread changed the date during the copy
+        uint32_t seq = 0;
+        do
+        {
+            seq = sequence_.load(std::memory_order_acquire);
+            memcpy(date, date_, sizeof(date));
+            wall_us = wall_us_.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+        } while ((seq & 1) || seq != sequence_.load(std::memory_order_relaxed));
+    }
+
+    return snprintf(buf, size, "%s.%03d", date, (int)((wall_us / 1000) % 1000));
+}
+
+void *Clock::update_thread(void *arg)
+{
+    Clock *clock = (Clock *)arg;
+    while (true)
+    {
+        ::usleep(clock->interval_us_);
+        clock->update();
+    }
+    return nullptr;
+}
+
+void Clock::update()
+{
+    steady_us_.store(Utils::GetSteadyMicroSeconds(), std::memory_order_relaxed);
+
+    timeval tv;
+    if (gettimeofday(&tv, nullptr) == -1)
+    {
+        return;
+    }
+
+    sequence_.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    // only convert the date when the second changed
+    if (tv.tv_sec != date_sec_)
+    {
+        format_second(tv.tv_sec, utc_, date_, sizeof(date_));
+        date_sec_ = tv.tv_sec;
+    }
+    wall_us_.store(tv.tv_sec * 1000000LL + tv.tv_usec, std::memory_order_relaxed);
+
+    sequence_.fetch_add(1, std::memory_order_release);
+}
+
+int Clock::format_second(int64_t sec, bool utc, char *buf, int size)
+{
+    time_t t = (time_t)sec;
+    struct tm now;
+    struct tm *tm = utc ? gmtime_r(&t, &now) : localtime_r(&t, &now);
+    if (tm == nullptr)
+    {
+        buf[0] = 0;
+        return 0;
+    }
+
+    return snprintf(buf, size, "%d-%02d-%02d %02d:%02d:%02d",
+                    1900 + tm->tm_year, 1 + tm->tm_mon, tm->tm_mday, tm->tm_hour, tm->tm_min, tm->tm_sec);
+}
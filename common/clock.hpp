@@ -0,0 +1,50 @@
+#ifndef RS_CLOCK_HPP
+#define RS_CLOCK_HPP
+
+#include <common/core.hpp>
+
+#include <atomic>
+
+// the size of date "YYYY-MM-DD HH:MM:SS.mmm" with the tail zero
+#define RS_CLOCK_DATE_SIZE 24
+
+/**
+ * the coarse clock of the process, updated by a thread every interval, so the hot paths
+ * read the time without syscall, and the log formats the date without localtime.
+ * before started, the time is read from system for each call.
+ */
+class Clock
+{
+public:
+    Clock();
+    virtual ~Clock();
+
+public:
+    // start the update thread, by each worker after fork
+    virtual int32_t Initialize(int interval_us, bool utc);
+    int64_t SteadyMS();
+    int64_t SteadyUS();
+    int64_t WallUS();
+    // format the date of wall time in buf, return the size
+    int FormatDate(char *buf, int size);
+
+private:
+    void update();
+    static void *update_thread(void *arg);
+    static int format_second(int64_t sec, bool utc, char *buf, int size);
+
+private:
+    bool utc_;
+    int interval_us_;
+    std::atomic<bool> started_;
+    std::atomic<int64_t> steady_us_;
+    // the wall time and its date are guarded by the sequence, odd when updating
+    std::atomic<uint32_t> sequence_;
+    std::atomic<int64_t> wall_us_;
+    int64_t date_sec_;
+    char date_[RS_CLOCK_DATE_SIZE];
+};
+
+extern Clock *_clock;
+
+#endif
@@ -129,3 +129,121 @@ double Config::GetQueueSize(const std::string &vhost)
 {
     return 5;
 }
+
+int Config::GetWorkers()
+{
+    // 1 keeps the single process mode, >1 forks workers sharing the port by SO_REUSEPORT
+    return 1;
+}
+
+bool Config::GetStreamAffinity()
+{
+    return true;
+}
+
+bool Config::GetPlaySingleCoroutine(const std::string &vhost)
+{
+    // the player reads the client in the send coroutine, without the recv coroutine
+    return false;
+}
+
+int Config::GetWakeupTickMS()
+{
+    // the batch interval of consumer wakeups, 0 to wake up immediately
+    return 10;
+}
+
+int Config::GetTimerTickMS()
+{
+    // the precision of the timeouts and sleeps by the timing wheel, 0 to use st
+    return 10;
+}
+
+int Config::GetClockIntervalUS()
+{
+    // the resolution of the coarse clock for log, kbps and dvr, 0 to read system time
+    return 1000;
+}
+
+bool Config::GetLogAsync()
+{
+    // flush the logs by a thread of each worker, the logs are dropped when queue full
+    return true;
+}
+
+int Config::GetLogQueueSize()
+{
+    // the records of the async log queue, each is 4KB
+    return 1024;
+}
+
+int Config::GetStackPrewarm()
+{
+    // coroutine stacks cached by st before accept, 0 to disable
+    return 256;
+}
+
+int Config::GetThreads()
+{
+    // scheduler threads of each worker, >1 requires the st built with thread local scheduler
+    return 1;
+}
+
+double Config::GetTimeShift(const std::string &vhost)
+{
+    // seconds of gops kept by each source, 0 to disable
+    return 60;
+}
+
+int64_t Config::GetTimeShiftMemory()
+{
+    // bytes of the time shift buffers of all sources
+    return 512 * 1024 * 1024;
+}
+
+int Config::GetDvrWriterThreads()
+{
+    // 0 writes the dvr files in st thread
+    return 2;
+}
+
+int Config::GetDvrWriterQueueDepth()
+{
+    // max writes in flight of each writer thread
+    return 1024;
+}
+
+std::string Config::GetIOBackend()
+{
+    // "st" or "io_uring", which requires build with RS_IO_URING
+    return RS_CONFIG_IO_BACKEND_ST;
+}
+
+int Config::GetUringEntries()
+{
+    return 4096;
+}
+
+bool Config::GetZeroCopy(const std::string &vhost)
+{
+    // MSG_ZEROCOPY of the player, linux 4.14+
+    return false;
+}
+
+int Config::GetZeroCopyThreshold()
+{
+    // the small messages are cheaper to copy than the page pinning
+    return 64 * 1024;
+}
+
+bool Config::GetChunkHeaderCompression(const std::string &vhost)
+{
+    // the fmt1/fmt2/fmt3 headers for the player, by the last message of chunk stream
+    return true;
+}
+
+int Config::GetAggregateSize(const std::string &vhost)
+{
+    // the max size of aggregate message to player, 0 to send the messages as is
+    return 0;
+}
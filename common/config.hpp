@@ -7,6 +7,9 @@
 #define RS_CONFIG_NVR_PLAN_APPEND "append"
 #define RS_CONFIG_NVR_PLAN_SEGMENT "segment"
 
+#define RS_CONFIG_IO_BACKEND_ST "st"
+#define RS_CONFIG_IO_BACKEND_URING "io_uring"
+
 inline bool rs_config_dvr_is_plan_segment(const std::string &plan)
 {
     return plan == RS_CONFIG_NVR_PLAN_SEGMENT;
@@ -53,6 +56,26 @@ public:
     virtual bool GetATCAuto(const std::string &vhost);
     virtual bool GetParseSPS(const std::string &vhost);
     virtual double GetQueueSize(const std::string &vhost);
+    virtual int GetWorkers();
+    virtual bool GetStreamAffinity();
+    virtual int GetThreads();
+    virtual int GetWakeupTickMS();
+    virtual int GetTimerTickMS();
+    virtual int GetClockIntervalUS();
+    virtual bool GetLogAsync();
+    virtual int GetLogQueueSize();
+    virtual int GetStackPrewarm();
+    virtual bool GetPlaySingleCoroutine(const std::string &vhost);
+    virtual double GetTimeShift(const std::string &vhost);
+    virtual int64_t GetTimeShiftMemory();
+    virtual int GetDvrWriterThreads();
+    virtual int GetDvrWriterQueueDepth();
+    virtual std::string GetIOBackend();
+    virtual int GetUringEntries();
+    virtual bool GetZeroCopy(const std::string &vhost);
+    virtual int GetZeroCopyThreshold();
+    virtual bool GetChunkHeaderCompression(const std::string &vhost);
+    virtual int GetAggregateSize(const std::string &vhost);
 };
 
 extern Config *_config;
@@ -10,5 +10,6 @@ bool IsClientGracefullyClose(int32_t err_code)
 bool IsSystemControlError(int err_code)
 {
     return err_code == ERROR_CONTROL_REPUBLISH ||
-            err_code == ERROR_CONTROL_RTMP_CLOSE;
+            err_code == ERROR_CONTROL_RTMP_CLOSE ||
+            err_code == ERROR_CONTROL_HANDOFF;
 }
@@ -69,6 +69,15 @@
 #define ERROR_SYSTEM_KILL                   1058
 #define ERROR_SYSTEM_DNS_RESOLVE            1059
 #define ERROR_SOCKET_SETKEEPALIVE           1060
+#define ERROR_SYSTEM_FORK                   1061
+#define ERROR_SYSTEM_WORKER_CHANNEL         1062
+#define ERROR_SYSTEM_WORKER_HANDOFF         1063
+#define ERROR_SYSTEM_FILE_BUSY              1064
+#define ERROR_SYSTEM_AIO_THREAD             1065
+#define ERROR_SYSTEM_URING                  1066
+#define ERROR_SYSTEM_SCHEDULER_THREAD       1067
+#define ERROR_SYSTEM_LOG_THREAD             1068
+#define ERROR_SYSTEM_CLOCK_THREAD           1069
 
 ///////////////////////////////////////////////////////
 // RTMP protocol error.
@@ -130,6 +139,8 @@
 //
 // system control message,
 // not an error, but special control logic.
+// sys ctl: client is passed to the stream owner worker.
+#define ERROR_CONTROL_HANDOFF               2997
 // sys ctl: rtmp close stream, support replay.
 #define ERROR_CONTROL_RTMP_CLOSE            2998
 // FMLE stop publish and republish.
@@ -2,6 +2,9 @@
 #include <common/file.hpp>
 #include <common/error.hpp>
 #include <common/log.hpp>
+#include <common/aio.hpp>
+#include <common/pool.hpp>
+#include <common/utils.hpp>
 
 #include <sys/stat.h>
 #include <unistd.h>
@@ -29,7 +32,8 @@
 
 FileWriter::FileWriter()
 {
-    stfd_ = nullptr;
+    file_ = nullptr;
+    offset_ = 0;
 }
 
 FileWriter::~FileWriter()
@@ -39,20 +43,45 @@ FileWriter::~FileWriter()
 
 void FileWriter::Close()
 {
-    int ret = ERROR_SUCCESS;
+    if (!file_)
+    {
+        return;
+    }
 
-    if (st_netfd_close(stfd_) < 0)
+    // closed by the aio thread after the pending writes, the file is freed when done
+    AioJob *job = new AioJob;
+    job->type = AioType::CLOSE;
+    job->file = file_;
+    job->offset = 0;
+    job->buf = nullptr;
+    job->size = 0;
+
+    if (_aio->Submit(job) != ERROR_SUCCESS)
     {
-        ret = ERROR_SYSTEM_FILE_CLOSE;
-        rs_error("close file %s failed. ret=%d", path_.c_str(), ret);
+        rs_freep(job);
+        // the fd is never closed under the pending writes, or they go to the reused fd
+        if (file_->pending > 0)
+        {
+            rs_warn("close file %s after the pending writes, pending=%d", path_.c_str(), file_->pending);
+            file_->closing = true;
+        }
+        else
+        {
+            if (file_->fd >= 0)
+            {
+                ::close(file_->fd);
+            }
+            rs_freep(file_);
+        }
     }
+    file_ = nullptr;
 }
 
 int FileWriter::Open(const std::string &path, bool append)
 {
     int ret = ERROR_SUCCESS;
 
-    if (stfd_)
+    if (file_)
     {
         ret = ERROR_SYSTEM_FILE_ALREADY_OPENED;
         rs_error("file %s already open. ret=%d", path.c_str(), ret);
@@ -62,72 +91,118 @@ int FileWriter::Open(const std::string &path, bool append)
     int flags = O_CREAT | O_WRONLY | O_TRUNC;
     if (append)
     {
-        flags = O_APPEND | O_WRONLY;
+        flags = O_WRONLY;
     }
 
-    mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP  | S_IROTH;
-    st_netfd_t stfd = st_open(path.c_str(), flags, mode);
-
-    if (!stfd)
+    // opened by the aio thread, the writes before done are queued after the open, and
+    // the droppable data is dropped by IsBusy. the error of open is reported by the
+    // next write
+    AioFile *file = _aio->Open(path, flags, append);
+    AioJob *job = new AioJob;
+    job->type = AioType::OPEN;
+    job->file = file;
+    job->offset = 0;
+    job->buf = nullptr;
+    job->size = 0;
+
+    if ((ret = _aio->Submit(job)) != ERROR_SUCCESS)
+    {
+        rs_error("open file %s failed. ret=%d", path.c_str(), ret);
+        rs_freep(job);
+        rs_freep(file);
+        return ret;
+    }
+    // opened in place without aio threads
+    if (file->opened && (ret = file->error) != ERROR_SUCCESS)
     {
-        ret = ERROR_SYSTEM_FILE_OPENE;
         rs_error("open file %s failed. ret=%d", path.c_str(), ret);
+        rs_freep(file);
         return ret;
     }
+
+    offset_ = 0;
     path_ = path;
-    stfd_ = stfd;
+    file_ = file;
 
     return ret;
 }
 
 bool FileWriter::IsOpen()
 {
-    return stfd_ != nullptr;
+    return file_ != nullptr;
+}
+
+bool FileWriter::IsBusy()
+{
+    return file_ && _aio->Busy(file_);
 }
 
 void FileWriter::Lseek(int64_t offset)
 {
-    ::lseek(st_netfd_fileno(stfd_), (off_t)offset, SEEK_SET);
+    offset_ = offset;
 }
 
 int64_t FileWriter::Tellg()
 {
-    return ::lseek(st_netfd_fileno(stfd_), 0, SEEK_CUR);
+    return offset_;
 }
 
 int FileWriter::Write(void* buf, size_t count, ssize_t* pnwrite)
 {
+    iovec iov;
+    iov.iov_base = buf;
+    iov.iov_len = count;
+    return Writev(&iov, 1, pnwrite);
+}
 
+int FileWriter::Writev(iovec* iov, int iovcnt, ssize_t *pnwrite)
+{
     int ret = ERROR_SUCCESS;
-    ssize_t nwrite = 0;
 
-    if ((nwrite = st_write(stfd_, buf, count, ST_UTIME_NO_TIMEOUT)) < 0) {
+    if (!file_)
+    {
         ret = ERROR_SYSTEM_FILE_WRITE;
-        rs_error("write to file %s failed. ret=%d", stfd_, ret);
+        rs_error("write to closed file %s. ret=%d", path_.c_str(), ret);
         return ret;
     }
 
-    if (pnwrite) {
-        *pnwrite = nwrite;
+    if ((ret = file_->error) != ERROR_SUCCESS)
+    {
+        rs_error("write to file %s failed. ret=%d", path_.c_str(), ret);
+        return ret;
     }
-    return ret;
 
-}
+    int size = 0;
+    for (int i = 0; i < iovcnt; i++)
+    {
+        size += (int)iov[i].iov_len;
+    }
 
-int FileWriter::Writev(iovec* iov, int iovcnt, ssize_t *pnwrite)
-{
-    int ret = ERROR_SUCCESS;
-    ssize_t nwrite = 0;
+    char *buf = BufferPool::Alloc(size);
+    char *p = buf;
+    for (int i = 0; i < iovcnt; i++)
+    {
+        memcpy(p, iov[i].iov_base, iov[i].iov_len);
+        p += iov[i].iov_len;
+    }
 
-    if ((nwrite = st_writev(stfd_, iov, iovcnt, ST_UTIME_NO_TIMEOUT)) < 0) {
-        ret = ERROR_SYSTEM_FILE_WRITE;
-        rs_error("writev to file %s failed. ret=%d", stfd_, ret);
+    AioJob *job = new AioJob;
+    job->type = AioType::WRITE;
+    job->file = file_;
+    job->offset = offset_;
+    job->buf = buf;
+    job->size = size;
+
+    if ((ret = _aio->Submit(job)) != ERROR_SUCCESS)
+    {
+        BufferPool::Free(buf);
+        rs_freep(job);
         return ret;
     }
 
+    offset_ += size;
     if (pnwrite) {
-        *pnwrite = nwrite;
+        *pnwrite = size;
     }
     return ret;
-
 }
@@ -4,6 +4,8 @@
 #include <common/reader.hpp>
 #include <common/st.hpp>
 
+#include <sys/uio.h>
+
 #include <string>
 
 // class FileReader: public Reader
@@ -29,6 +31,13 @@
 //     int32_t fd_;
 // };
 
+struct AioFile;
+
+/**
+ * the open and writes are done by the aio threads, the writes are copied and done at
+ * the offset, so the file position here is logical, from where the file is opened.
+ * the error of the open or a write is reported by the next write.
+ */
 class FileWriter
 {
 public:
@@ -38,6 +47,8 @@ public:
     virtual int Open(const std::string &path, bool append=false);
     virtual void Close();
     virtual bool IsOpen();
+    // too many writes in flight, the droppable data should be dropped
+    virtual bool IsBusy();
     virtual void Lseek(int64_t offset);
     virtual int64_t Tellg();
     virtual int Write(void *buf, size_t count, ssize_t *pnwrite);
@@ -45,7 +56,8 @@ public:
 
 private:
     std::string path_;
-    st_netfd_t stfd_;
+    AioFile *file_;
+    int64_t offset_;
 };
 
 #endif
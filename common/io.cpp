@@ -62,6 +62,16 @@ IProtocolReaderWriter::~IProtocolReaderWriter()
 
 }
 
+IZeroCopyWriter::IZeroCopyWriter()
+{
+
+}
+
+IZeroCopyWriter::~IZeroCopyWriter()
+{
+
+}
+
 IMergeReadHandler::IMergeReadHandler()
 {
 
@@ -4,6 +4,9 @@
 #include <common/core.hpp>
 #include <sys/uio.h>
 
+#include <utility>
+#include <vector>
+
 
 /**
 +---------------+     +--------------------+      +---------------+
@@ -38,6 +41,8 @@ public:
 
 public:
     virtual int32_t Read(void *buf, size_t size, ssize_t *nread) = 0;
+    // scatter read, may read less than the iovs
+    virtual int32_t ReadEv(const struct iovec *iov, int iov_size, ssize_t *nread) = 0;
 };
 
 class IBufferWriter
@@ -100,6 +105,26 @@ public:
 };
 
 
+/**
+ * the writer supports MSG_ZEROCOPY, the memory of the zerocopy write must not be
+ * changed or freed until the id of the write is completed.
+ */
+class IZeroCopyWriter
+{
+public:
+    IZeroCopyWriter();
+    virtual ~IZeroCopyWriter();
+
+public:
+    virtual bool EnableZeroCopy() = 0;
+    // the ids of the writes are [first, last], for the partial writes
+    virtual int32_t WriteEvZeroCopy(const struct iovec *iov, size_t iov_size, uint32_t *first, uint32_t *last) = 0;
+    // the completed ids, each range is [first, last]
+    virtual void ReapZeroCopy(std::vector<std::pair<uint32_t, uint32_t> > &ranges) = 0;
+    // the dup fd to reap the completions after the writer is freed, -1 when disabled
+    virtual int DupZeroCopy() = 0;
+};
+
 class IMergeReadHandler
 {
 public:
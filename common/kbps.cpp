@@ -1,5 +1,6 @@
 #include <common/kbps.hpp>
 #include <common/utils.hpp>
+#include <common/clock.hpp>
 
 IKbpsDelta::IKbpsDelta()
 {
@@ -38,7 +39,7 @@ int64_t KbpsSlice::GetTotalBytes()
 
 void KbpsSlice::Sample()
 {
-    int64_t now = Utils::GetSteadyMilliSeconds();
+    int64_t now = _clock->SteadyMS();
     int64_t total_bytes = GetTotalBytes();
 
     if (sample_30s.time <= 0)
@@ -160,7 +161,7 @@ void Kbps::SetIO(IStatistic *in, IStatistic *out)
 {
     if (is_.start_time == 0)
     {
-        is_.start_time = Utils::GetSteadyMilliSeconds();
+        is_.start_time = _clock->SteadyMS();
     }
 
     if (is_.io.in)
@@ -178,7 +179,7 @@ void Kbps::SetIO(IStatistic *in, IStatistic *out)
 
     if (os_.start_time == 0)
     {
-        os_.start_time = Utils::GetSteadyMilliSeconds();
+        os_.start_time = _clock->SteadyMS();
     }
 
     if (os_.io.out)
@@ -5,8 +5,12 @@
 #include <common/log.hpp>
 
 #include  <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 #define RS_SERVER_LISTEN_BACKLOG 512
+// the max clients accepted by one wakeup of the listener
+#define RS_SERVER_ACCEPT_BATCH 64
 
 ITCPClientHandler::ITCPClientHandler()
 {
@@ -20,8 +24,9 @@ ITCPClientHandler::~ITCPClientHandler()
 
 TCPListener::TCPListener(ITCPClientHandler *client_handler,
                         const std::string &ip,
-                        int32_t port): client_handler_(client_handler),
-                        ip_(ip), port_(port), fd_(-1),
+                        int32_t port,
+                        bool reuse_port): client_handler_(client_handler),
+                        ip_(ip), port_(port), reuse_port_(reuse_port), fd_(-1),
                         stfd_(nullptr)
 {
     thread_ = new internal::Thread("tcp-listener", this, 0, true);
@@ -64,6 +69,14 @@ int32_t TCPListener::Listen()
     }
     rs_verbose("set socket reuse address success, ep=[%s:%d]", ip_.c_str(), port_);
 
+    // every worker binds its own listen socket, the kernel balances the accepts
+    if (reuse_port_ && ::setsockopt(fd_, SOL_SOCKET, SO_REUSEPORT, &reuse_socket, sizeof(int32_t)) == -1)
+    {
+        ret = ERROR_SOCKET_SETREUSE;
+        rs_error("set socket reuse port failed, ep=[%s:%d], ret=%d", ip_.c_str(), port_, ret);
+        return ret;
+    }
+
     int32_t tcp_keepalive = 1;
     if (::setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &tcp_keepalive, sizeof(int32_t)) == -1)
     {
@@ -137,5 +150,32 @@ int32_t TCPListener::Cycle()
         return ret;
     }
 
+    // drain the backlog without polling again, the listen fd is nonblocking
+    for (int i = 1; i < RS_SERVER_ACCEPT_BATCH; i++)
+    {
+        int fd = ::accept(fd_, nullptr, nullptr);
+        if (fd == -1)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                rs_warn("drain accept failed, ep=[%s:%d], errno=%d", ip_.c_str(), port_, errno);
+            }
+            break;
+        }
+
+        if ((client_stfd = st_netfd_open_socket(fd)) == nullptr)
+        {
+            ::close(fd);
+            rs_error("st_netfd_open_socket client failed, ep=[%s:%d], fd=%d", ip_.c_str(), port_, fd);
+            break;
+        }
+
+        if ((ret = client_handler_->OnTCPClient(client_stfd)) != ERROR_SUCCESS)
+        {
+            rs_error("handle new client failed, ep=[%s:%d]", ip_.c_str(), port_);
+            return ret;
+        }
+    }
+
     return ret;
 }
@@ -25,7 +25,7 @@ public:
 class TCPListener: public internal::IThreadHandler
 {
 public:
-    TCPListener(ITCPClientHandler *client_handler, const std::string &ip, int32_t port);
+    TCPListener(ITCPClientHandler *client_handler, const std::string &ip, int32_t port, bool reuse_port = false);
     virtual ~TCPListener();
 public:
     virtual int32_t Listen();
@@ -38,6 +38,7 @@ private:
     ITCPClientHandler *client_handler_;
     std::string ip_;
     int32_t port_;
+    bool reuse_port_;
     int32_t fd_;
     st_netfd_t stfd_;
     internal::Thread *thread_;
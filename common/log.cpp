@@ -1,12 +1,25 @@
 #include <common/log.hpp>
 #include <common/error.hpp>
 #include <common/utils.hpp>
+#include <common/config.hpp>
+#include <common/clock.hpp>
 #include <stdarg.h>
+#include <atomic>
 #include <time.h>
+#include <pthread.h>
+#include <unistd.h>
 #include <sys/time.h>
 
-ILog::ILog()
+// the log thread sleeps when the ring is empty
+#define RS_LOG_FLUSH_INTERVAL_US 10000
+
+ILog::ILog() : level_(LogLevel::VERBOSE)
+{
+}
+
+int32_t ILog::Initialize()
 {
+    return ERROR_SUCCESS;
 }
 
 ILog::~ILog()
@@ -39,6 +52,11 @@ void ILog::Error(const char*, int32_t, const char *, ...)
 
 }
 
+void ILog::Flush()
+{
+
+}
+
 IThreadContext::IThreadContext()
 {
 
@@ -70,21 +88,180 @@ void IThreadContext::ClearID()
 }
 
 
-#define RS_LOG_MAX_SIZE 4096
 #define RS_LOG_TAIL '\n'
 #define RS_LOG_TAIL_SIZE 1
 
+LogRing::LogRing(int size) : tail_(0), head_(0)
+{
+    capacity_ = 1;
+    while (capacity_ < size)
+    {
+        capacity_ <<= 1;
+    }
+    mask_ = capacity_ - 1;
+
+    records_ = new LogRecord[capacity_];
+    for (int i = 0; i < capacity_; i++)
+    {
+        records_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+LogRing::~LogRing()
+{
+    rs_freepa(records_);
+}
+
+bool LogRing::Push(int32_t level, const char *data, int32_t size)
+{
+    // the slot is free when its sequence equals the position, claimed by the cas of tail
+    uint64_t pos = tail_.load(std::memory_order_relaxed);
+    LogRecord *record = nullptr;
+    while (true)
+    {
+        record = &records_[pos & mask_];
+        uint64_t seq = record->sequence.load(std::memory_order_acquire);
+        int64_t diff = (int64_t)seq - (int64_t)pos;
+        if (diff == 0)
+        {
+            if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            return false;
+        }
+        else
+        {
+            pos = tail_.load(std::memory_order_relaxed);
+        }
+    }
+
+    record->level = level;
+    record->size = rs_min(size, RS_LOG_MAX_SIZE);
+    memcpy(record->data, data, record->size);
+    record->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+LogRecord *LogRing::Front()
+{
+    LogRecord *record = &records_[head_ & mask_];
+    if (record->sequence.load(std::memory_order_acquire) != head_ + 1)
+    {
+        return nullptr;
+    }
+    return record;
+}
+
+void LogRing::Pop()
+{
+    LogRecord *record = &records_[head_ & mask_];
+    record->sequence.store(head_ + capacity_, std::memory_order_release);
+    head_++;
+}
+
+thread_local char *FastLog::log_data_ = nullptr;
+
 FastLog::FastLog() : fd_(-1),
                      log_to_file_tank_(false),
-                     utc_(false)
+                     utc_(false),
+                     ring_(nullptr),
+                     nb_dropped_(0),
+                     nb_dropped_reported_(0)
 {
-    log_data_ = new char[RS_LOG_MAX_SIZE];
     level_ = LogLevel::VERBOSE;
+    pid_ = getpid();
+}
+
+int32_t FastLog::Initialize()
+{
+    int32_t ret = ERROR_SUCCESS;
+
+    // the pid of worker, cached for the header of each log
+    pid_ = getpid();
+
+    if (!_config->GetLogAsync() || ring_)
+    {
+        return ret;
+    }
+
+    // the thread is never stopped, the ring lives as long as the process
+    ring_ = new LogRing(_config->GetLogQueueSize());
+
+    pthread_t tid;
+    if (::pthread_create(&tid, nullptr, FastLog::flush_thread, this) != 0)
+    {
+        rs_freep(ring_);
+        ret = ERROR_SYSTEM_LOG_THREAD;
+        rs_error("create log thread failed, ret=%d", ret);
+        return ret;
+    }
+    ::pthread_detach(tid);
+
+    rs_trace("async log started, queue=%d", _config->GetLogQueueSize());
+    return ret;
+}
+
+int64_t FastLog::GetDroppedLogs()
+{
+    return nb_dropped_.load(std::memory_order_relaxed);
+}
+
+void *FastLog::flush_thread(void *arg)
+{
+    FastLog *log = (FastLog *)arg;
+    while (true)
+    {
+        log->flush();
+        ::usleep(RS_LOG_FLUSH_INTERVAL_US);
+    }
+    return nullptr;
+}
+
+void FastLog::Flush()
+{
+    if (ring_)
+    {
+        flush();
+    }
+}
+
+void FastLog::flush()
+{
+    std::lock_guard<std::mutex> lock(flush_mutex_);
+
+    int nb_records = 0;
+    LogRecord *record = nullptr;
+    while ((record = ring_->Front()) != nullptr)
+    {
+        write_console(record->data, record->size, record->level);
+        ring_->Pop();
+        nb_records++;
+    }
+
+    int64_t nb_dropped = nb_dropped_.load(std::memory_order_relaxed);
+    if (nb_dropped != nb_dropped_reported_)
+    {
+        char msg[128];
+        int size = snprintf(msg, sizeof(msg), "[log] dropped %lld logs for the queue is full, total %lld\n",
+                            (long long)(nb_dropped - nb_dropped_reported_), (long long)nb_dropped);
+        write_console(msg, size, LogLevel::WARN);
+        nb_dropped_reported_ = nb_dropped;
+        nb_records++;
+    }
+
+    // one flush for the batch
+    if (nb_records > 0)
+    {
+        fflush(stdout);
+    }
 }
 
 FastLog::~FastLog()
 {
-    rs_freep(log_data_);
     if (fd_>0)
     {
         close(fd_);
@@ -193,37 +370,30 @@ int32_t FastLog::OnReloadLogFile()
 
 bool FastLog::GenerateHeader(bool error, const char *tag, int32_t context_id, const char *level_name, int32_t *header_size)
 {
-    timeval tv;
-    if (gettimeofday(&tv, nullptr) == -1)
-        return false;
-
-    struct tm *tm;
-    if(utc_)
-    {
-        if((tm=gmtime(&tv.tv_sec)) == nullptr)
-            return false;
-    }else
+    // lives as long as the thread
+    if (!log_data_)
     {
-        if((tm = localtime(&tv.tv_sec)) == nullptr)
-            return false;
+        log_data_ = new char[RS_LOG_MAX_SIZE];
     }
 
+    // the date is formatted by the coarse clock, without syscall
+    char date[RS_CLOCK_DATE_SIZE];
+    _clock->FormatDate(date, sizeof(date));
+
     int32_t log_header_size = -1;
     if (error)
     {
         if (tag)
         {
             log_header_size = snprintf(log_data_, RS_LOG_MAX_SIZE,
-                                        "[%d-%02d-%02d %02d:%02d:%02d.%03d][%s][%s][%d][%d][%d]",
-                                        1900+tm->tm_year, 1 + tm->tm_mon, tm->tm_mday, tm->tm_hour, tm->tm_min, tm->tm_sec, (int32_t)(tv.tv_usec/1000),
-                                        level_name, tag, getpid(), context_id, errno);
+                                        "[%s][%s][%s][%d][%d][%d]",
+                                        date, level_name, tag, pid_, context_id, errno);
         }
         else
         {
             log_header_size = snprintf(log_data_, RS_LOG_MAX_SIZE,
-                                        "[%d-%02d-%02d %02d:%02d:%02d.%03d][%s][%d][%d][%d]",
-                                        1900+tm->tm_year, 1 + tm->tm_mon, tm->tm_mday, tm->tm_hour, tm->tm_min, tm->tm_sec, (int32_t)(tv.tv_usec/1000),
-                                        level_name, getpid(), context_id, errno);
+                                        "[%s][%s][%d][%d][%d]",
+                                        date, level_name, pid_, context_id, errno);
 
         }
     }
@@ -232,16 +402,14 @@ bool FastLog::GenerateHeader(bool error, const char *tag, int32_t context_id, co
         if(tag)
         {
             log_header_size = snprintf(log_data_, RS_LOG_MAX_SIZE,
-                                        "[%d-%02d-%02d %02d:%02d:%02d.%03d][%s][%s][%d][%d]",
-                                        1900+tm->tm_year, 1 + tm->tm_mon, tm->tm_mday, tm->tm_hour, tm->tm_min, tm->tm_sec, (int32_t)(tv.tv_usec/1000),
-                                        level_name, tag, getpid(), context_id);
+                                        "[%s][%s][%s][%d][%d]",
+                                        date, level_name, tag, pid_, context_id);
         }
         else
         {
             log_header_size = snprintf(log_data_, RS_LOG_MAX_SIZE,
-                                        "[%d-%02d-%02d %02d:%02d:%02d.%03d][%s][%d][%d]",
-                                        1900+tm->tm_year, 1 + tm->tm_mon, tm->tm_mday, tm->tm_hour, tm->tm_min, tm->tm_sec, (int32_t)(tv.tv_usec/1000),
-                                        level_name, getpid(), context_id);
+                                        "[%s][%s][%d][%d]",
+                                        date, level_name, pid_, context_id);
         }
     }
     if (log_header_size == -1)
@@ -257,34 +425,56 @@ void FastLog::WriteLog(int32_t &fd_, char *str_log, int32_t size, int32_t level)
     size =  rs_min(RS_LOG_MAX_SIZE - RS_LOG_TAIL_SIZE, size);
 
     str_log[size++] = RS_LOG_TAIL;
+
     if(!log_to_file_tank_)
     {
-        if (level == LogLevel::VERBOSE)
-        {
-            printf("\033[36m%.*s\033[0m", size, str_log);
-            // printf("%.*s", size, str_log);
-        }
-        else if (level == LogLevel::TRACE)
-        {
-            printf("\033[34m%.*s\033[0m", size, str_log);
-        }
-        else if (level == LogLevel::INFO)
+        if (ring_)
         {
-            printf("\033[32m%.*s\033[0m", size, str_log);
-        }
-        else if (level == LogLevel::WARN)
-        {
-            printf("\033[33m%.*s\033[0m", size, str_log);
-        }
-        else{
-            printf("\033[31m%.*s\033[0m", size, str_log);
+            if (ring_->Push(level, str_log, size))
+            {
+                return;
+            }
+            // the warn and error explain the failure, never dropped
+            if (level < LogLevel::WARN)
+            {
+                nb_dropped_++;
+                return;
+            }
         }
+
+        write_console(str_log, size, level);
         fflush(stdout);
     }
 
     return;
 }
 
+void FastLog::write_console(char *str_log, int32_t size, int32_t level)
+{
+    if (level == LogLevel::VERBOSE)
+    {
+        printf("\033[36m%.*s\033[0m", size, str_log);
+        // printf("%.*s", size, str_log);
+    }
+    else if (level == LogLevel::TRACE)
+    {
+        printf("\033[34m%.*s\033[0m", size, str_log);
+    }
+    else if (level == LogLevel::INFO)
+    {
+        printf("\033[32m%.*s\033[0m", size, str_log);
+    }
+    else if (level == LogLevel::WARN)
+    {
+        printf("\033[33m%.*s\033[0m", size, str_log);
+    }
+    else{
+        printf("\033[31m%.*s\033[0m", size, str_log);
+    }
+}
+
+
+thread_local std::map<st_thread_t, int32_t> ThreadContext::cache_;
 
 ThreadContext::ThreadContext()
 {
@@ -298,7 +488,7 @@ ThreadContext::~ThreadContext()
 
 int32_t ThreadContext::GenerateID()
 {
-    static int32_t id = 100;
+    static std::atomic<int32_t> id(100);
     int32_t cid = id++;
     cache_[st_thread_self()] = cid;
     return cid;
@@ -2,7 +2,9 @@
 #define RS_LOG_HPP
 #include <common/core.hpp>
 #include <common/reload.hpp>
+#include <atomic>
 #include <map>
+#include <mutex>
 #include <st.h>
 
 #include <stdio.h>
@@ -20,13 +22,20 @@ struct LogLevel
     static const int32_t DISABLE = 0x06;
 };
 
+#define RS_LOG_MAX_SIZE 4096
+
 class ILog
 {
 public:
     ILog();
     virtual ~ILog();
 public:
-    int32_t Initialize();
+    virtual int32_t Initialize();
+    // checked by the macros before any formatting
+    bool Enabled(int32_t level)
+    {
+        return level >= level_;
+    }
 
 public:
     virtual void Verbose(const char *tag, int32_t context_id, const char *fmt, ...);
@@ -34,6 +43,11 @@ public:
     virtual void Trace(const char *tag, int32_t context_id, const char *fmt, ...);
     virtual void Warn(const char *tag, int32_t context_id, const char *fmt, ...);
     virtual void Error(const char *tag, int32_t context_id, const char *fmt, ...);
+    // write the queued logs, before the process exits
+    virtual void Flush();
+
+protected:
+    int32_t level_;
 };
 
 class IThreadContext
@@ -63,45 +77,60 @@ extern IThreadContext *_context;
 // #define rs_trace(msg, ...) _log->Trace(__FUNCTION__, _context->GetID(), msg, ##__VA_ARGS__)
 // #define rs_warn(msg, ...) _log->Warn(__FUNCTION__, _context->GetID(), msg, ##__VA_ARGS__)
 // #define rs_error(msg, ...) _log->Error(__FUNCTION__, _context->GetID(), msg, ##__VA_ARGS__)
-#define rs_verbose(msg, ...)                                                 \
-    do                                                                      \
-    {                                                                       \
-        char tag[1024] = {0};                                               \
-        snprintf(tag, 1024, "%s:%d<%s>", __FILE__, __LINE__, __FUNCTION__); \
-        _log->Verbose(tag, _context->GetID(), msg, ##__VA_ARGS__);          \
+#define rs_verbose(msg, ...)                                                    \
+    do                                                                          \
+    {                                                                           \
+        if (_log->Enabled(LogLevel::VERBOSE))                                   \
+        {                                                                       \
+            char tag[1024] = {0};                                               \
+            snprintf(tag, 1024, "%s:%d<%s>", __FILE__, __LINE__, __FUNCTION__); \
+            _log->Verbose(tag, _context->GetID(), msg, ##__VA_ARGS__);          \
+        }                                                                       \
     }while (0)
 
-#define rs_info(msg, ...)                                                   \
-    do                                                                      \
-    {                                                                       \
-        char tag[1024] = {0};                                               \
-        snprintf(tag, 1024, "%s:%d<%s>", __FILE__, __LINE__, __FUNCTION__); \
-        _log->Info(tag, _context->GetID(), msg, ##__VA_ARGS__);             \
+#define rs_info(msg, ...)                                                       \
+    do                                                                          \
+    {                                                                           \
+        if (_log->Enabled(LogLevel::INFO))                                      \
+        {                                                                       \
+            char tag[1024] = {0};                                               \
+            snprintf(tag, 1024, "%s:%d<%s>", __FILE__, __LINE__, __FUNCTION__); \
+            _log->Info(tag, _context->GetID(), msg, ##__VA_ARGS__);             \
+        }                                                                       \
     }while (0)
 
-#define rs_trace(msg, ...)                                                  \
-    do                                                                      \
-    {                                                                       \
-        char tag[1024] = {0};                                               \
-        snprintf(tag, 1024, "%s:%d<%s>", __FILE__, __LINE__, __FUNCTION__); \
-        _log->Trace(tag, _context->GetID(), msg, ##__VA_ARGS__);            \
+#define rs_trace(msg, ...)                                                      \
+    do                                                                          \
+    {                                                                           \
+        if (_log->Enabled(LogLevel::TRACE))                                     \
+        {                                                                       \
+            char tag[1024] = {0};                                               \
+            snprintf(tag, 1024, "%s:%d<%s>", __FILE__, __LINE__, __FUNCTION__); \
+            _log->Trace(tag, _context->GetID(), msg, ##__VA_ARGS__);            \
+        }                                                                       \
     }while (0)
 
-#define rs_warn(msg, ...)                                                   \
-    do                                                                      \
-    {                                                                       \
-        char tag[1024] = {0};                                               \
-        snprintf(tag, 1024, "%s:%d<%s>", __FILE__, __LINE__, __FUNCTION__); \
-        _log->Warn(tag, _context->GetID(), msg, ##__VA_ARGS__);             \
+#define rs_warn(msg, ...)                                                       \
+    do                                                                          \
+    {                                                                           \
+        if (_log->Enabled(LogLevel::WARN))                                      \
+        {                                                                       \
+            char tag[1024] = {0};                                               \
+            snprintf(tag, 1024, "%s:%d<%s>", __FILE__, __LINE__, __FUNCTION__); \
+            _log->Warn(tag, _context->GetID(), msg, ##__VA_ARGS__);             \
+        }                                                                       \
     }while (0)
 
-#define rs_error(msg, ...)                                                  \
-    do                                                                      \
-    {                                                                       \
-        char tag[1024] = {0};                                               \
-        snprintf(tag, 1024, "%s:%d<%s>", __FILE__, __LINE__, __FUNCTION__); \
-        _log->Error(tag, _context->GetID(), msg, ##__VA_ARGS__);            \
-    }while (0)                                                              \
+#define rs_error(msg, ...)                                                      \
+    do                                                                          \
+    {                                                                           \
+        if (_log->Enabled(LogLevel::ERROR))                                     \
+        {                                                                       \
+            char tag[1024] = {0};                                               \
+            snprintf(tag, 1024, "%s:%d<%s>", __FILE__, __LINE__, __FUNCTION__); \
+            _log->Error(tag, _context->GetID(), msg, ##__VA_ARGS__);            \
+        }                                                                       \
+    }while (0)
 
 #else
 #define rs_verbose(msg, ...)                                                 \
@@ -145,6 +174,40 @@ extern IThreadContext *_context;
     }while (0)
 #endif
 
+// the record formatted by the caller thread, flushed by the log thread
+struct LogRecord
+{
+    std::atomic<uint64_t> sequence;
+    int32_t level;
+    int32_t size;
+    char data[RS_LOG_MAX_SIZE];
+};
+
+/**
+ * bounded lock free ring of the log records, pushed by all the scheduler threads and
+ * popped by the only log thread. the push fails when the ring is full, never blocks,
+ * then the warn and error logs are written in place, the others are dropped.
+ */
+class LogRing
+{
+public:
+    LogRing(int size);
+    virtual ~LogRing();
+
+public:
+    virtual bool Push(int32_t level, const char *data, int32_t size);
+    // the record at front, nullptr when empty, released by Pop
+    virtual LogRecord *Front();
+    virtual void Pop();
+
+private:
+    LogRecord *records_;
+    int capacity_;
+    int mask_;
+    std::atomic<uint64_t> tail_;
+    uint64_t head_;
+};
+
 class FastLog: public ILog, IReloadHandler
 {
 public:
@@ -152,11 +215,15 @@ public:
     virtual ~FastLog();
 
 public:
+    // start the log thread when async, by each worker process
+    virtual int32_t Initialize() override;
     virtual void Verbose(const char *tag, int32_t context_id, const char *fmt, ...);
     virtual void Info(const char *tag, int32_t context_id, const char *fmt, ...);
     virtual void Trace(const char *tag, int32_t context_id, const char *fmt, ...);
     virtual void Warn(const char *tag, int32_t context_id, const char *fmt, ...);
     virtual void Error(const char *tag, int32_t context_id, const char *fmt, ...);
+    virtual void Flush() override;
+    virtual int64_t GetDroppedLogs();
 
 public:
     virtual int32_t OnReloadUTCTime();
@@ -168,12 +235,24 @@ protected:
     virtual bool GenerateHeader(bool error, const char *tag, int context_id, const char* level_name, int32_t *header_size);
     virtual void WriteLog(int &fd, char *str_log, int32_t size, int32_t level);
 
+private:
+    void write_console(char *str_log, int32_t size, int32_t level);
+    static void *flush_thread(void *arg);
+    void flush();
+
 private:
     int32_t fd_;
     bool log_to_file_tank_;
     bool utc_;
-    char *log_data_;
-    int32_t level_;
+    // each scheduler thread formats in its own buffer
+    static thread_local char *log_data_;
+    // async when the ring is created
+    LogRing *ring_;
+    // the ring has one consumer, the log thread or the exiting thread
+    std::mutex flush_mutex_;
+    pid_t pid_;
+    std::atomic<int64_t> nb_dropped_;
+    int64_t nb_dropped_reported_;
 };
 
 class ThreadContext:public IThreadContext
@@ -188,6 +267,6 @@ public:
     virtual int32_t SetID(int v) override;
     virtual void ClearID() override;
 private:
-    std::map<st_thread_t, int32_t> cache_;
+    static thread_local std::map<st_thread_t, int32_t> cache_;
 };
 #endif
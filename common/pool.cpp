@@ -0,0 +1,96 @@
+#include <common/pool.hpp>
+
+// the header before the buffer, keep 16 bytes alignment
+#define RS_BUFFER_POOL_HEADER 16
+#define RS_BUFFER_POOL_CLASSES 4
+#define RS_BUFFER_POOL_OVERSIZE -1
+
+static const int buffer_class_sizes[RS_BUFFER_POOL_CLASSES] = {256, 4 * 1024, 64 * 1024, 1024 * 1024};
+// max cached buffers of each class, about 1MB, 4MB, 16MB, 16MB
+static const int buffer_class_limits[RS_BUFFER_POOL_CLASSES] = {4096, 1024, 256, 16};
+
+struct BufferNode
+{
+    BufferNode *next;
+};
+
+struct BufferPoolLocal
+{
+    BufferNode *free_lists[RS_BUFFER_POOL_CLASSES];
+    int nb_free[RS_BUFFER_POOL_CLASSES];
+    BufferPoolStat stat;
+};
+
+static BufferPoolLocal &buffer_pool_local()
+{
+    static thread_local BufferPoolLocal l = {{nullptr}, {0}, {0, 0, 0, 0}};
+    return l;
+}
+
+char *BufferPool::Alloc(int size)
+{
+    BufferPoolLocal &l = buffer_pool_local();
+    l.stat.nb_allocs++;
+
+    int c = 0;
+    while (c < RS_BUFFER_POOL_CLASSES && buffer_class_sizes[c] < size)
+    {
+        c++;
+    }
+
+    char *p = nullptr;
+    if (c == RS_BUFFER_POOL_CLASSES)
+    {
+        l.stat.nb_oversize++;
+        p = (char *)malloc(RS_BUFFER_POOL_HEADER + size);
+        rs_assert(p);
+        *(int *)p = RS_BUFFER_POOL_OVERSIZE;
+        return p + RS_BUFFER_POOL_HEADER;
+    }
+
+    if (l.free_lists[c])
+    {
+        p = (char *)l.free_lists[c];
+        l.free_lists[c] = l.free_lists[c]->next;
+        l.nb_free[c]--;
+        l.stat.nb_reused++;
+        l.stat.bytes_held -= buffer_class_sizes[c];
+    }
+    else
+    {
+        p = (char *)malloc(RS_BUFFER_POOL_HEADER + buffer_class_sizes[c]);
+        rs_assert(p);
+    }
+
+    *(int *)p = c;
+    return p + RS_BUFFER_POOL_HEADER;
+}
+
+void BufferPool::Free(char *p)
+{
+    if (!p)
+    {
+        return;
+    }
+
+    p -= RS_BUFFER_POOL_HEADER;
+    int c = *(int *)p;
+
+    BufferPoolLocal &l = buffer_pool_local();
+    if (c == RS_BUFFER_POOL_OVERSIZE || l.nb_free[c] >= buffer_class_limits[c])
+    {
+        free(p);
+        return;
+    }
+
+    BufferNode *node = (BufferNode *)p;
+    node->next = l.free_lists[c];
+    l.free_lists[c] = node;
+    l.nb_free[c]++;
+    l.stat.bytes_held += buffer_class_sizes[c];
+}
+
+BufferPoolStat &BufferPool::Stat()
+{
+    return buffer_pool_local().stat;
+}
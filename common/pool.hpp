@@ -0,0 +1,204 @@
+#ifndef RS_POOL_HPP
+#define RS_POOL_HPP
+
+#include <common/core.hpp>
+#include <common/utils.hpp>
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <atomic>
+#include <type_traits>
+
+// objects per slab
+#define RS_POOL_SLAB_OBJECTS 256
+
+struct PoolStat
+{
+    int64_t nb_allocs;
+    // allocs served by the free list, without malloc
+    int64_t nb_hits;
+    int64_t nb_frees;
+    int64_t in_use;
+    int64_t high_water;
+    int64_t nb_slabs;
+
+    double HitRate()
+    {
+        return nb_allocs > 0 ? (double)nb_hits / nb_allocs : 0;
+    }
+};
+
+struct BufferPoolStat
+{
+    int64_t nb_allocs;
+    // allocations served by the cached buffers, without malloc
+    int64_t nb_reused;
+    // larger than the max size class, always malloc
+    int64_t nb_oversize;
+    // bytes cached in the free lists
+    int64_t bytes_held;
+};
+
+/**
+ * per thread size class buffer pool, for the message payload.
+ * the classes are 256B, 4KB, 64KB and 1MB, each class caches limited buffers.
+ * the buffer must be freed by BufferPool::Free, never by delete.
+ */
+class BufferPool
+{
+public:
+    static char *Alloc(int size);
+    static void Free(char *p);
+    static BufferPoolStat &Stat();
+};
+
+/**
+ * per thread free list of fixed size objects, refilled by slabs of RS_POOL_SLAB_OBJECTS.
+ * the object freed by other thread is pushed to the lock free remote list of its owner,
+ * which is taken back by the owner when the free list is empty, so the object always
+ * returns to the thread which allocated it. the in_use of owner counts the remote frees
+ * when taken back. slabs are never returned to system, the pool only grows to the high
+ * water mark, and the threads of pool live as long as the process.
+ * usage, define the class operator new/delete by SlabPool<T>::Alloc/Free.
+ */
+template <typename T>
+class SlabPool
+{
+public:
+    static void *Alloc();
+    static void Free(void *p);
+    static PoolStat &Stat();
+
+private:
+    struct Local;
+
+    struct Node
+    {
+        // the pool of the thread which allocated the slab
+        Local *owner;
+        union
+        {
+            Node *next;
+            typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+        };
+    };
+
+    struct Local
+    {
+        Local() : free_list(nullptr), remote_free(nullptr), stat() {}
+
+        Node *free_list;
+        // pushed by other threads, taken by the owner
+        std::atomic<Node *> remote_free;
+        PoolStat stat;
+    };
+
+    static Local &local();
+    static void refill(Local &l);
+    // take back the objects freed by other threads, return false when none
+    static bool reclaim(Local &l);
+};
+
+template <typename T>
+typename SlabPool<T>::Local &SlabPool<T>::local()
+{
+    static thread_local Local l;
+    return l;
+}
+
+template <typename T>
+void SlabPool<T>::refill(Local &l)
+{
+    Node *slab = (Node *)malloc(sizeof(Node) * RS_POOL_SLAB_OBJECTS);
+    rs_assert(slab);
+    for (int i = 0; i < RS_POOL_SLAB_OBJECTS; i++)
+    {
+        slab[i].owner = &l;
+        slab[i].next = l.free_list;
+        l.free_list = &slab[i];
+    }
+    l.stat.nb_slabs++;
+}
+
+template <typename T>
+bool SlabPool<T>::reclaim(Local &l)
+{
+    if (!l.remote_free.load(std::memory_order_relaxed))
+    {
+        return false;
+    }
+
+    Node *node = l.remote_free.exchange(nullptr, std::memory_order_acquire);
+    while (node)
+    {
+        Node *next = node->next;
+        node->next = l.free_list;
+        l.free_list = node;
+        node = next;
+
+        l.stat.nb_frees++;
+        l.stat.in_use--;
+    }
+    return true;
+}
+
+template <typename T>
+void *SlabPool<T>::Alloc()
+{
+    Local &l = local();
+    l.stat.nb_allocs++;
+
+    if (l.free_list || reclaim(l))
+    {
+        l.stat.nb_hits++;
+    }
+    else
+    {
+        refill(l);
+    }
+
+    Node *node = l.free_list;
+    l.free_list = node->next;
+
+    if (++l.stat.in_use > l.stat.high_water)
+    {
+        l.stat.high_water = l.stat.in_use;
+    }
+    return &node->storage;
+}
+
+template <typename T>
+void SlabPool<T>::Free(void *p)
+{
+    if (!p)
+    {
+        return;
+    }
+
+    Local &l = local();
+    Node *node = (Node *)((char *)p - offsetof(Node, storage));
+    if (node->owner != &l)
+    {
+        Local *owner = node->owner;
+        Node *head = owner->remote_free.load(std::memory_order_relaxed);
+        do
+        {
+            node->next = head;
+        } while (!owner->remote_free.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_relaxed));
+        return;
+    }
+
+    node->next = l.free_list;
+    l.free_list = node;
+
+    l.stat.nb_frees++;
+    l.stat.in_use--;
+}
+
+template <typename T>
+PoolStat &SlabPool<T>::Stat()
+{
+    return local().stat;
+}
+
+#endif
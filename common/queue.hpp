@@ -5,6 +5,10 @@
 #include <common/log.hpp>
 #include <common/utils.hpp>
 
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+
 #define FAST_VEC_DEFAULT_SIZE 1024
 #define MIX_CORRECT_PURE_AV 10
 
@@ -37,7 +41,7 @@ template <typename T>
 FastVector<T>::FastVector(int size)
 {
     count_ = 0;
-    nb_msgs_ = FAST_VEC_DEFAULT_SIZE;
+    nb_msgs_ = size;
     msgs_ = new T[size];
 }
 
@@ -121,7 +125,7 @@ void FastVector<T>::PushBack(T msg)
     {
         int size = nb_msgs_ * 2;
         T *buf = new T[size];
-        for (int i=0;i<size;i++)
+        for (int i=0;i<count_;i++)
         {
             buf[i] = msgs_[i];
         }
@@ -133,6 +137,239 @@ void FastVector<T>::PushBack(T msg)
     count_++;
 }
 
+/**
+ * power of 2 ring, O(1) push back and batch pop from front.
+ */
+template <typename T>
+class RingQueue
+{
+public:
+    RingQueue(int size = FAST_VEC_DEFAULT_SIZE);
+    virtual ~RingQueue();
+
+public:
+    virtual int Size();
+    virtual bool Empty();
+    // the index-th element from front
+    virtual T At(int index);
+    virtual T Front();
+    virtual void PushBack(T msg);
+    virtual int PopFront(T *pmsgs, int max_count);
+    virtual void Clear();
+    virtual void Free();
+
+private:
+    void grow();
+
+private:
+    T *msgs_;
+    int capacity_;
+    int mask_;
+    int64_t head_;
+    int64_t tail_;
+};
+
+template <typename T>
+RingQueue<T>::RingQueue(int size)
+{
+    capacity_ = 1;
+    while (capacity_ < size)
+    {
+        capacity_ <<= 1;
+    }
+    mask_ = capacity_ - 1;
+    msgs_ = new T[capacity_];
+    head_ = tail_ = 0;
+}
+
+template <typename T>
+RingQueue<T>::~RingQueue()
+{
+    Free();
+    rs_freepa(msgs_);
+}
+
+template <typename T>
+int RingQueue<T>::Size()
+{
+    return (int)(tail_ - head_);
+}
+
+template <typename T>
+bool RingQueue<T>::Empty()
+{
+    return tail_ == head_;
+}
+
+template <typename T>
+T RingQueue<T>::At(int index)
+{
+    return msgs_[(head_ + index) & mask_];
+}
+
+template <typename T>
+T RingQueue<T>::Front()
+{
+    return msgs_[head_ & mask_];
+}
+
+template <typename T>
+void RingQueue<T>::grow()
+{
+    int size = Size();
+    T *buf = new T[capacity_ * 2];
+    for (int i = 0; i < size; i++)
+    {
+        buf[i] = At(i);
+    }
+    rs_freepa(msgs_);
+    msgs_ = buf;
+    capacity_ *= 2;
+    mask_ = capacity_ - 1;
+    head_ = 0;
+    tail_ = size;
+}
+
+template <typename T>
+void RingQueue<T>::PushBack(T msg)
+{
+    if (Size() >= capacity_)
+    {
+        grow();
+    }
+    msgs_[tail_ & mask_] = msg;
+    tail_++;
+}
+
+template <typename T>
+int RingQueue<T>::PopFront(T *pmsgs, int max_count)
+{
+    int count = rs_min(Size(), max_count);
+    for (int i = 0; i < count; i++)
+    {
+        pmsgs[i] = msgs_[(head_ + i) & mask_];
+    }
+    head_ += count;
+    return count;
+}
+
+template <typename T>
+void RingQueue<T>::Clear()
+{
+    head_ = tail_ = 0;
+}
+
+template <typename T>
+void RingQueue<T>::Free()
+{
+    while (head_ < tail_)
+    {
+        T msg = msgs_[head_ & mask_];
+        rs_freep(msg);
+        head_++;
+    }
+    Clear();
+}
+
+/**
+ * lock free queue of one producer thread and one consumer thread, power of 2 size.
+ */
+template <typename T>
+class SPSCQueue
+{
+public:
+    SPSCQueue(int size);
+    virtual ~SPSCQueue();
+
+    // the cache line aligned indexes, which the new of c++11 never honours
+    static void *operator new(size_t size);
+    static void operator delete(void *p);
+
+public:
+    // by the producer, false when full
+    virtual bool Push(T msg);
+    // by the consumer, false when empty
+    virtual bool Pop(T &msg);
+    virtual bool Empty();
+
+private:
+    T *msgs_;
+    int capacity_;
+    int mask_;
+    // keep the consumer and producer index in different cache lines
+    alignas(64) std::atomic<int64_t> head_;
+    alignas(64) std::atomic<int64_t> tail_;
+};
+
+template <typename T>
+SPSCQueue<T>::SPSCQueue(int size)
+{
+    capacity_ = 1;
+    while (capacity_ < size)
+    {
+        capacity_ <<= 1;
+    }
+    mask_ = capacity_ - 1;
+    msgs_ = new T[capacity_];
+    head_.store(0);
+    tail_.store(0);
+}
+
+template <typename T>
+SPSCQueue<T>::~SPSCQueue()
+{
+    rs_freepa(msgs_);
+}
+
+template <typename T>
+void *SPSCQueue<T>::operator new(size_t size)
+{
+    void *p = nullptr;
+    if (::posix_memalign(&p, 64, size) != 0)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+template <typename T>
+void SPSCQueue<T>::operator delete(void *p)
+{
+    ::free(p);
+}
+
+template <typename T>
+bool SPSCQueue<T>::Push(T msg)
+{
+    int64_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) >= capacity_)
+    {
+        return false;
+    }
+    msgs_[tail & mask_] = msg;
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+template <typename T>
+bool SPSCQueue<T>::Pop(T &msg)
+{
+    int64_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire))
+    {
+        return false;
+    }
+    msg = msgs_[head & mask_];
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+template <typename T>
+bool SPSCQueue<T>::Empty()
+{
+    return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+}
+
 template <typename T>
 class MixQueue
 {
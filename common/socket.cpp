@@ -2,12 +2,39 @@
 #include <common/error.hpp>
 #include <common/utils.hpp>
 #include <common/log.hpp>
+#include <common/timer.hpp>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#ifdef __linux__
+#include <linux/errqueue.h>
+#endif
+#include <string.h>
+#include <unistd.h>
+
+// skip the n bytes written of the iovs
+static void advance_iovs(iovec *&p, int &nb_left, size_t n)
+{
+    while (nb_left > 0 && n >= p->iov_len)
+    {
+        n -= p->iov_len;
+        p++;
+        nb_left--;
+    }
+    if (nb_left > 0)
+    {
+        p->iov_base = (char *)p->iov_base + n;
+        p->iov_len -= n;
+    }
+}
 
 StSocket::StSocket(st_netfd_t stfd): stfd_(stfd),
                                      send_timeout_(ST_UTIME_NO_TIMEOUT),
                                      recv_timeout_(ST_UTIME_NO_TIMEOUT),
                                      send_bytes_(0),
-                                     recv_bytes_(0){}
+                                     recv_bytes_(0),
+                                     zerocopy_id_(0),
+                                     zerocopy_(false){}
 
 StSocket::~StSocket() {}
 
@@ -46,9 +73,124 @@ int64_t StSocket::GetRecvBytes()
     return recv_bytes_;
 }
 
+ssize_t StSocket::readv_reaping(const struct iovec *iov, int iov_size)
+{
+    int fd = st_netfd_fileno(stfd_);
+    while (true)
+    {
+        ssize_t nread = ::readv(fd, iov, iov_size);
+        if (nread >= 0)
+        {
+            return nread;
+        }
+        if (errno == EINTR)
+        {
+            continue;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            return -1;
+        }
+        if (poll_reaping(POLLIN, recv_timeout_) < 0)
+        {
+            return -1;
+        }
+    }
+}
+
+ssize_t StSocket::sendmsg_reaping(const struct msghdr *msg, int flags)
+{
+    int fd = st_netfd_fileno(stfd_);
+    while (true)
+    {
+        ssize_t nwrite = ::sendmsg(fd, msg, flags);
+        if (nwrite >= 0)
+        {
+            return nwrite;
+        }
+        if (errno == EINTR)
+        {
+            continue;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            return -1;
+        }
+        if (poll_reaping(POLLOUT, send_timeout_) < 0)
+        {
+            return -1;
+        }
+    }
+}
+
+ssize_t StSocket::writev_reaping(const struct iovec *iov, int iov_size)
+{
+    size_t total = 0;
+    for (int i = 0; i < iov_size; i++)
+    {
+        total += iov[i].iov_len;
+    }
+
+    std::vector<iovec> left(iov, iov + iov_size);
+    iovec *p = &left[0];
+    int nb_left = iov_size;
+    size_t written = 0;
+    while (written < total)
+    {
+        msghdr msg;
+        memset(&msg, 0, sizeof(msghdr));
+        msg.msg_iov = p;
+        msg.msg_iovlen = nb_left;
+
+        ssize_t nb_write = sendmsg_reaping(&msg, 0);
+        if (nb_write < 0)
+        {
+            return -1;
+        }
+        written += nb_write;
+        advance_iovs(p, nb_left, nb_write);
+    }
+    return (ssize_t)written;
+}
+
+int StSocket::poll_reaping(short events, int64_t timeout_us)
+{
+    int fd = st_netfd_fileno(stfd_);
+
+    pollfd pd;
+    pd.fd = fd;
+    pd.events = events;
+    pd.revents = 0;
+    int r = _wheel->Poll(&pd, 1, timeout_us);
+    if (r <= 0)
+    {
+        if (r == 0)
+        {
+            errno = ETIME;
+        }
+        return -1;
+    }
+    if (pd.revents & POLLERR)
+    {
+        ReapZeroCopyFd(fd, reaped_);
+    }
+    return 0;
+}
+
 int32_t StSocket::Read(void *buf, size_t size, ssize_t *nread)
 {
-    ssize_t nb_read = st_read(stfd_, buf, size, recv_timeout_);
+    ssize_t nb_read = 0;
+    if (zerocopy_)
+    {
+        iovec iov;
+        iov.iov_base = buf;
+        iov.iov_len = size;
+        nb_read = readv_reaping(&iov, 1);
+    }
+    else
+    {
+        nb_read = _wheel->Read(stfd_, buf, size, recv_timeout_);
+    }
     if (nread)
     {
         *nread = nb_read;
@@ -73,7 +215,32 @@ int32_t StSocket::Read(void *buf, size_t size, ssize_t *nread)
 
 int32_t StSocket::ReadFully(void *buf, size_t size, ssize_t *nread)
 {
-    ssize_t nb_read = st_read_fully(stfd_, buf, size, recv_timeout_);
+    ssize_t nb_read = 0;
+    if (zerocopy_)
+    {
+        // like st_read_fully, the partial bytes when eof
+        while (nb_read < (ssize_t)size)
+        {
+            iovec iov;
+            iov.iov_base = (char *)buf + nb_read;
+            iov.iov_len = size - nb_read;
+            ssize_t n = readv_reaping(&iov, 1);
+            if (n < 0)
+            {
+                nb_read = -1;
+                break;
+            }
+            if (n == 0)
+            {
+                break;
+            }
+            nb_read += n;
+        }
+    }
+    else
+    {
+        nb_read = _wheel->ReadFully(stfd_, buf, size, recv_timeout_);
+    }
     if (nread)
     {
         *nread = nb_read;
@@ -96,10 +263,45 @@ int32_t StSocket::ReadFully(void *buf, size_t size, ssize_t *nread)
     return ERROR_SUCCESS;
 }
 
+int32_t StSocket::ReadEv(const struct iovec *iov, int iov_size, ssize_t *nread)
+{
+    ssize_t nb_read = zerocopy_ ? readv_reaping(iov, iov_size) : _wheel->Readv(stfd_, iov, iov_size, recv_timeout_);
+    if (nread)
+    {
+        *nread = nb_read;
+    }
+
+    if(nb_read <=0 )
+    {
+        if (nb_read < 0 && errno == ETIME)
+        {
+            return ERROR_SOCKET_TIMEOUT;
+        }
+        else if (nb_read == 0)
+        {
+            errno = ECONNRESET;
+        }
+        return ERROR_SOCKET_READ;
+    }
+
+    recv_bytes_ += nb_read;
+    return ERROR_SUCCESS;
+}
 
 int32_t StSocket::Write(void *buf, size_t size, ssize_t *nwrite)
 {
-    ssize_t nb_write = st_write(stfd_, buf, size, send_timeout_);
+    ssize_t nb_write = 0;
+    if (zerocopy_)
+    {
+        iovec iov;
+        iov.iov_base = buf;
+        iov.iov_len = size;
+        nb_write = writev_reaping(&iov, 1);
+    }
+    else
+    {
+        nb_write = st_write(stfd_, buf, size, send_timeout_);
+    }
     if (nwrite)
     {
         *nwrite = nb_write;
@@ -120,7 +322,7 @@ int32_t StSocket::Write(void *buf, size_t size, ssize_t *nwrite)
 
 int32_t StSocket::WriteEv(const struct iovec *iov, size_t iov_size, ssize_t *nwrite)
 {
-    ssize_t nb_write = st_writev(stfd_, iov, iov_size, send_timeout_);
+    ssize_t nb_write = zerocopy_ ? writev_reaping(iov, (int)iov_size) : st_writev(stfd_, iov, iov_size, send_timeout_);
 
     if (nwrite)
     {
@@ -139,6 +341,157 @@ int32_t StSocket::WriteEv(const struct iovec *iov, size_t iov_size, ssize_t *nwr
     return ERROR_SUCCESS;
 }
 
+void *StSocket::operator new(size_t size)
+{
+    if (size != sizeof(StSocket))
+    {
+        return ::operator new(size);
+    }
+    return SlabPool<StSocket>::Alloc();
+}
+
+void StSocket::operator delete(void *p, size_t size)
+{
+    if (size != sizeof(StSocket))
+    {
+        ::operator delete(p);
+        return;
+    }
+    SlabPool<StSocket>::Free(p);
+}
+
+bool StSocket::EnableZeroCopy()
+{
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+    int v = 1;
+    if (setsockopt(st_netfd_fileno(stfd_), SOL_SOCKET, SO_ZEROCOPY, &v, sizeof(v)) < 0)
+    {
+        rs_warn("set socket SO_ZEROCOPY failed, errno=%d", errno);
+        return false;
+    }
+    zerocopy_ = true;
+#endif
+    return zerocopy_;
+}
+
+int32_t StSocket::WriteEvZeroCopy(const struct iovec *iov, size_t iov_size, uint32_t *first, uint32_t *last)
+{
+    if (!zerocopy_)
+    {
+        *first = zerocopy_id_;
+        *last = zerocopy_id_ - 1;
+        return WriteEv(iov, iov_size, nullptr);
+    }
+
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+    size_t total = 0;
+    for (size_t i = 0; i < iov_size; i++)
+    {
+        total += iov[i].iov_len;
+    }
+
+    // like st_writev, the partial write continues from the offset, each write has an id
+    std::vector<iovec> left(iov, iov + iov_size);
+    iovec *p = &left[0];
+    int nb_left = (int)iov_size;
+    size_t written = 0;
+
+    *first = zerocopy_id_;
+    while (written < total)
+    {
+        msghdr msg;
+        memset(&msg, 0, sizeof(msghdr));
+        msg.msg_iov = p;
+        msg.msg_iovlen = nb_left;
+
+        ssize_t nb_write = sendmsg_reaping(&msg, MSG_ZEROCOPY);
+        if (nb_write < 0 && errno == ENOBUFS)
+        {
+            // the optmem of socket is exhausted, copy the left
+            nb_write = writev_reaping(p, nb_left);
+            if (nb_write > 0)
+            {
+                send_bytes_ += nb_write;
+                break;
+            }
+        }
+        if (nb_write <= 0)
+        {
+            *last = zerocopy_id_ - 1;
+            if (nb_write < 0 && errno == ETIME)
+            {
+                return ERROR_SOCKET_TIMEOUT;
+            }
+            return ERROR_SOCKET_WRITE;
+        }
+
+        zerocopy_id_++;
+        written += nb_write;
+        send_bytes_ += nb_write;
+        advance_iovs(p, nb_left, nb_write);
+    }
+    *last = zerocopy_id_ - 1;
+#endif
+
+    return ERROR_SUCCESS;
+}
+
+void StSocket::ReapZeroCopy(std::vector<std::pair<uint32_t, uint32_t> > &ranges)
+{
+    if (!zerocopy_)
+    {
+        return;
+    }
+
+    ranges.insert(ranges.end(), reaped_.begin(), reaped_.end());
+    reaped_.clear();
+    ReapZeroCopyFd(st_netfd_fileno(stfd_), ranges);
+}
+
+int StSocket::DupZeroCopy()
+{
+    if (!zerocopy_)
+    {
+        return -1;
+    }
+    return ::dup(st_netfd_fileno(stfd_));
+}
+
+void ReapZeroCopyFd(int fd, std::vector<std::pair<uint32_t, uint32_t> > &ranges)
+{
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+    while (true)
+    {
+        char control[128];
+        msghdr msg;
+        memset(&msg, 0, sizeof(msghdr));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (::recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+        {
+            return;
+        }
+
+        for (cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm))
+        {
+            if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                  (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+            {
+                continue;
+            }
+
+            sock_extended_err *serr = (sock_extended_err *)CMSG_DATA(cm);
+            if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+            {
+                continue;
+            }
+            ranges.push_back(std::make_pair(serr->ee_info, serr->ee_data));
+        }
+    }
+#endif
+}
+
 int SendLargeIovs(IProtocolReaderWriter* rw,
                     iovec*                 iovs,
                     int                    size,
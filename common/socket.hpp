@@ -3,19 +3,29 @@
 
 #include <common/core.hpp>
 #include <common/io.hpp>
+#include <common/pool.hpp>
 #include <st.h>
 
+#include <vector>
+
 extern int SendLargeIovs(IProtocolReaderWriter* rw,
                            iovec *iovs,
                            int size,
                            ssize_t* pnwrite);
 
-class StSocket : public IProtocolReaderWriter
+// the completed ids of the zerocopy writes in the error queue of fd, without block
+extern void ReapZeroCopyFd(int fd, std::vector<std::pair<uint32_t, uint32_t> > &ranges);
+
+class StSocket : public IProtocolReaderWriter, public IZeroCopyWriter
 {
 public:
     StSocket(st_netfd_t client_stfd);
     virtual ~StSocket();
 
+    // allocated from the per thread slab pool
+    static void *operator new(size_t size);
+    static void operator delete(void *p, size_t size);
+
 public:
     virtual bool IsNeverTimeout(int64_t timeout_us) override;
     virtual void SetRecvTimeout(int64_t timeout_us) override;
@@ -28,15 +38,35 @@ public:
 public:
     virtual int32_t Read(void *buf, size_t size, ssize_t *nread) override;
     virtual int32_t ReadFully(void *buf, size_t size, ssize_t *nread) override;
+    virtual int32_t ReadEv(const struct iovec *iov, int iov_size, ssize_t *nread) override;
     virtual int32_t Write(void *buf, size_t size, ssize_t *nread) override;
     virtual int32_t WriteEv(const struct iovec *iov, size_t iov_size, ssize_t *nwrite) override;
+    // IZeroCopyWriter
+    virtual bool EnableZeroCopy() override;
+    virtual int32_t WriteEvZeroCopy(const struct iovec *iov, size_t iov_size, uint32_t *first, uint32_t *last) override;
+    virtual void ReapZeroCopy(std::vector<std::pair<uint32_t, uint32_t> > &ranges) override;
+    virtual int DupZeroCopy() override;
 
 private:
+    // the io which reaps the zerocopy completions, which raise POLLERR and never
+    // block the poll of st
+    int poll_reaping(short events, int64_t timeout_us);
+    ssize_t readv_reaping(const struct iovec *iov, int iov_size);
+    // return when any bytes sent, like st_sendmsg
+    ssize_t sendmsg_reaping(const struct msghdr *msg, int flags);
+    // return when all bytes sent, like st_writev
+    ssize_t writev_reaping(const struct iovec *iov, int iov_size);
+
     st_netfd_t stfd_;
     int64_t send_timeout_;
     int64_t recv_timeout_;
     int64_t send_bytes_;
     int64_t recv_bytes_;
+    // the id of the next zerocopy write, counted by kernel for each sendmsg
+    uint32_t zerocopy_id_;
+    bool zerocopy_;
+    // the completions reaped by read and write, for the next ReapZeroCopy
+    std::vector<std::pair<uint32_t, uint32_t> > reaped_;
 };
 
 #endif
@@ -3,6 +3,8 @@
 #include <common/log.hpp>
 #include <common/utils.hpp>
 
+#include <vector>
+
 int32_t STInit()
 {
     int32_t ret = ERROR_SUCCESS;
@@ -35,3 +37,30 @@ void STCloseFd(st_netfd_t &stfd)
         stfd = nullptr;
     }
 }
+
+static void *st_prewarm_function(void *arg)
+{
+    return nullptr;
+}
+
+void STPrewarmStacks(int n)
+{
+    std::vector<st_thread_t> threads;
+    for (int i = 0; i < n; i++)
+    {
+        st_thread_t st = st_thread_create(st_prewarm_function, nullptr, 1, 0);
+        if (st == nullptr)
+        {
+            rs_warn("prewarm stacks stopped at %d/%d", i, n);
+            break;
+        }
+        threads.push_back(st);
+    }
+
+    for (size_t i = 0; i < threads.size(); i++)
+    {
+        st_thread_join(threads[i], nullptr);
+    }
+
+    rs_trace("prewarm %d coroutine stacks", (int)threads.size());
+}
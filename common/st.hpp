@@ -5,5 +5,7 @@
 #include <st.h>
 extern int32_t STInit();
 extern void STCloseFd(st_netfd_t &stfd);
+// create and join n coroutines, st caches their stacks for the later coroutines
+extern void STPrewarmStacks(int n);
 
 #endif
@@ -1,6 +1,7 @@
 #include <common/thread.hpp>
 #include <common/log.hpp>
 #include <common/error.hpp>
+#include <common/timer.hpp>
 
 
 namespace internal
@@ -126,7 +127,7 @@ void Thread::Dispatch()
 
         if (interval_us_ != 0)
         {
-            st_usleep(interval_us_);
+            _wheel->Sleep(interval_us_);
         }
     }
 
@@ -166,7 +167,11 @@ void Thread::Dispose()
     if (disposed_)
         return;
 
-    st_thread_interrupt(st_);
+    // the exited non joinable thread is freed by st, and its stack maybe reused
+    if (!really_terminated_ || joinable_)
+    {
+        st_thread_interrupt(st_);
+    }
     if(joinable_)
     {
         st_thread_join(st_, nullptr);
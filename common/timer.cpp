@@ -0,0 +1,309 @@
+#include <common/timer.hpp>
+#include <common/error.hpp>
+#include <common/log.hpp>
+#include <common/utils.hpp>
+
+#include <errno.h>
+
+#define RS_TIMER_WHEEL_MASK (RS_TIMER_WHEEL_SLOTS - 1)
+// the max ticks of the wheel, the longer timer is clamped
+#define RS_TIMER_WHEEL_MAX_TICKS ((1ULL << (RS_TIMER_WHEEL_BITS * RS_TIMER_WHEEL_LEVELS)) - 1)
+
+TimingWheel::TimingWheel() : tick_us_(0),
+                             now_(0),
+                             last_us_(0),
+                             count_(0),
+                             cond_(nullptr),
+                             waiting_(false),
+                             thread_(nullptr)
+{
+    for (int i = 0; i < RS_TIMER_WHEEL_LEVELS; i++)
+    {
+        for (int j = 0; j < RS_TIMER_WHEEL_SLOTS; j++)
+        {
+            slots_[i][j].prev = slots_[i][j].next = &slots_[i][j];
+        }
+    }
+}
+
+TimingWheel::~TimingWheel()
+{
+    if (thread_)
+    {
+        thread_->Stop();
+    }
+    rs_freep(thread_);
+    if (cond_)
+    {
+        st_cond_destroy(cond_);
+    }
+}
+
+int32_t TimingWheel::Initialize(int tick_ms)
+{
+    int32_t ret = ERROR_SUCCESS;
+
+    tick_us_ = tick_ms * 1000;
+    if (tick_us_ <= 0)
+    {
+        return ret;
+    }
+
+    cond_ = st_cond_new();
+    last_us_ = Utils::GetSteadyMicroSeconds();
+
+    thread_ = new internal::Thread("timer", this, 0, false);
+    if ((ret = thread_->Start()) != ERROR_SUCCESS)
+    {
+        rs_error("start timing wheel failed, ret=%d", ret);
+        return ret;
+    }
+
+    rs_trace("timing wheel started, tick=%dms", tick_ms);
+    return ret;
+}
+
+void TimingWheel::Arm(TimerNode *node, int64_t timeout_us)
+{
+    node->st = st_thread_self();
+    node->fired = false;
+
+    // fire at the tick after the timeout, never earlier
+    uint64_t ticks = (uint64_t)((timeout_us + tick_us_ - 1) / tick_us_);
+    node->expire = now_ + rs_min(ticks, RS_TIMER_WHEEL_MAX_TICKS);
+    add(node);
+    count_++;
+
+    if (waiting_)
+    {
+        waiting_ = false;
+        st_cond_signal(cond_);
+    }
+}
+
+bool TimingWheel::Disarm(TimerNode *node, bool interrupted)
+{
+    if (!node->fired)
+    {
+        remove(node);
+        count_--;
+        return false;
+    }
+
+    // the timer fired after the coroutine was waked up by others, the interrupt is
+    // pending and will break the next wait, so consume it without yield
+    if (!interrupted)
+    {
+        int err = errno;
+        st_usleep(0);
+        errno = err;
+    }
+    return true;
+}
+
+bool TimingWheel::enabled(int64_t timeout_us)
+{
+    return thread_ && timeout_us != (int64_t)ST_UTIME_NO_TIMEOUT && timeout_us >= tick_us_;
+}
+
+int TimingWheel::Sleep(int64_t timeout_us)
+{
+    if (!enabled(timeout_us))
+    {
+        return st_usleep(timeout_us);
+    }
+
+    TimerNode node;
+    Arm(&node, timeout_us);
+    st_usleep(ST_UTIME_NO_TIMEOUT);
+
+    if (Disarm(&node, true))
+    {
+        return 0;
+    }
+    errno = EINTR;
+    return -1;
+}
+
+int TimingWheel::CondTimedWait(st_cond_t cond, int64_t timeout_us)
+{
+    if (!enabled(timeout_us))
+    {
+        return st_cond_timedwait(cond, timeout_us);
+    }
+
+    TimerNode node;
+    Arm(&node, timeout_us);
+    int r = st_cond_wait(cond);
+
+    bool interrupted = r == -1 && errno == EINTR;
+    if (Disarm(&node, interrupted) && interrupted)
+    {
+        errno = ETIME;
+    }
+    return r;
+}
+
+ssize_t TimingWheel::Read(st_netfd_t stfd, void *buf, size_t size, int64_t timeout_us)
+{
+    if (!enabled(timeout_us))
+    {
+        return st_read(stfd, buf, size, timeout_us);
+    }
+
+    TimerNode node;
+    Arm(&node, timeout_us);
+    ssize_t nread = st_read(stfd, buf, size, ST_UTIME_NO_TIMEOUT);
+
+    bool interrupted = nread == -1 && errno == EINTR;
+    if (Disarm(&node, interrupted) && interrupted)
+    {
+        errno = ETIME;
+    }
+    return nread;
+}
+
+ssize_t TimingWheel::ReadFully(st_netfd_t stfd, void *buf, size_t size, int64_t timeout_us)
+{
+    if (!enabled(timeout_us))
+    {
+        return st_read_fully(stfd, buf, size, timeout_us);
+    }
+
+    TimerNode node;
+    Arm(&node, timeout_us);
+    ssize_t nread = st_read_fully(stfd, buf, size, ST_UTIME_NO_TIMEOUT);
+
+    bool interrupted = nread == -1 && errno == EINTR;
+    if (Disarm(&node, interrupted) && interrupted)
+    {
+        errno = ETIME;
+    }
+    return nread;
+}
+
+ssize_t TimingWheel::Readv(st_netfd_t stfd, const struct iovec *iov, int iov_size, int64_t timeout_us)
+{
+    if (!enabled(timeout_us))
+    {
+        return st_readv(stfd, iov, iov_size, timeout_us);
+    }
+
+    TimerNode node;
+    Arm(&node, timeout_us);
+    ssize_t nread = st_readv(stfd, iov, iov_size, ST_UTIME_NO_TIMEOUT);
+
+    bool interrupted = nread == -1 && errno == EINTR;
+    if (Disarm(&node, interrupted) && interrupted)
+    {
+        errno = ETIME;
+    }
+    return nread;
+}
+
+int TimingWheel::Poll(struct pollfd *pds, int npds, int64_t timeout_us)
+{
+    if (!enabled(timeout_us))
+    {
+        return st_poll(pds, npds, timeout_us);
+    }
+
+    TimerNode node;
+    Arm(&node, timeout_us);
+    int r = st_poll(pds, npds, ST_UTIME_NO_TIMEOUT);
+
+    bool interrupted = r == -1 && errno == EINTR;
+    if (Disarm(&node, interrupted) && interrupted)
+    {
+        return 0;
+    }
+    return r;
+}
+
+int32_t TimingWheel::Cycle()
+{
+    // never tick when no timer armed
+    if (count_ == 0)
+    {
+        waiting_ = true;
+        st_cond_wait(cond_);
+        waiting_ = false;
+        last_us_ = Utils::GetSteadyMicroSeconds();
+    }
+
+    st_usleep(tick_us_);
+
+    // catch up the ticks when the thread is busy
+    int64_t now_us = Utils::GetSteadyMicroSeconds();
+    while (now_us - last_us_ >= tick_us_)
+    {
+        advance();
+        last_us_ += tick_us_;
+    }
+
+    return ERROR_SUCCESS;
+}
+
+void TimingWheel::add(TimerNode *node)
+{
+    uint64_t expire = rs_max(node->expire, now_);
+    uint64_t delta = expire - now_;
+
+    int level = 0;
+    while (level < RS_TIMER_WHEEL_LEVELS - 1 && delta >= (1ULL << ((level + 1) * RS_TIMER_WHEEL_BITS)))
+    {
+        level++;
+    }
+
+    TimerNode *head = &slots_[level][(expire >> (level * RS_TIMER_WHEEL_BITS)) & RS_TIMER_WHEEL_MASK];
+    node->prev = head->prev;
+    node->next = head;
+    head->prev->next = node;
+    head->prev = node;
+}
+
+void TimingWheel::remove(TimerNode *node)
+{
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->prev = node->next = nullptr;
+}
+
+void TimingWheel::cascade(int level)
+{
+    TimerNode *head = &slots_[level][(now_ >> (level * RS_TIMER_WHEEL_BITS)) & RS_TIMER_WHEEL_MASK];
+    TimerNode *node = head->next;
+    head->prev = head->next = head;
+
+    while (node != head)
+    {
+        TimerNode *next = node->next;
+        add(node);
+        node = next;
+    }
+}
+
+void TimingWheel::advance()
+{
+    // move the timers of the upper level down, when the lower level wraps
+    for (int level = 1; level < RS_TIMER_WHEEL_LEVELS; level++)
+    {
+        if ((now_ >> ((level - 1) * RS_TIMER_WHEEL_BITS)) & RS_TIMER_WHEEL_MASK)
+        {
+            break;
+        }
+        cascade(level);
+    }
+
+    TimerNode *head = &slots_[0][now_ & RS_TIMER_WHEEL_MASK];
+    while (head->next != head)
+    {
+        TimerNode *node = head->next;
+        remove(node);
+        count_--;
+        node->fired = true;
+        st_thread_interrupt(node->st);
+    }
+
+    now_++;
+}
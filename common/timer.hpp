@@ -0,0 +1,77 @@
+#ifndef RS_TIMER_HPP
+#define RS_TIMER_HPP
+
+#include <common/core.hpp>
+#include <common/thread.hpp>
+
+#include <st.h>
+#include <sys/uio.h>
+#include <poll.h>
+
+// the slots of each level, and the levels of the wheel
+#define RS_TIMER_WHEEL_BITS 6
+#define RS_TIMER_WHEEL_SLOTS (1 << RS_TIMER_WHEEL_BITS)
+#define RS_TIMER_WHEEL_LEVELS 4
+
+// the timer of a waiting coroutine, on the stack of the waiter
+struct TimerNode
+{
+    TimerNode *prev;
+    TimerNode *next;
+    uint64_t expire;
+    st_thread_t st;
+    bool fired;
+};
+
+/**
+ * hierarchical timing wheel of a scheduler thread, the timeouts of the coroutines are
+ * armed and canceled in O(1), instead of the sleep heap of st.
+ * the timer interrupts the waiting coroutine when expired, so the wait must be an
+ * interruptible st call without timeout. the precision is the tick.
+ */
+class TimingWheel : public internal::IThreadHandler
+{
+public:
+    TimingWheel();
+    virtual ~TimingWheel();
+
+public:
+    virtual int32_t Initialize(int tick_ms);
+    // arm the timer of the calling coroutine
+    virtual void Arm(TimerNode *node, int64_t timeout_us);
+    // cancel the timer, return true when expired. the interrupted is whether the wait
+    // returned by interrupt, otherwise the pending interrupt of the timer is consumed
+    virtual bool Disarm(TimerNode *node, bool interrupted);
+    // the st_usleep, st_cond_timedwait and st_read with the timer of wheel
+    virtual int Sleep(int64_t timeout_us);
+    virtual int CondTimedWait(st_cond_t cond, int64_t timeout_us);
+    virtual ssize_t Read(st_netfd_t stfd, void *buf, size_t size, int64_t timeout_us);
+    virtual ssize_t ReadFully(st_netfd_t stfd, void *buf, size_t size, int64_t timeout_us);
+    virtual ssize_t Readv(st_netfd_t stfd, const struct iovec *iov, int iov_size, int64_t timeout_us);
+    // the st_poll, return 0 when timeout
+    virtual int Poll(struct pollfd *pds, int npds, int64_t timeout_us);
+    // internal::IThreadHandler
+    virtual int32_t Cycle() override;
+
+private:
+    bool enabled(int64_t timeout_us);
+    void add(TimerNode *node);
+    void remove(TimerNode *node);
+    void cascade(int level);
+    void advance();
+
+private:
+    int64_t tick_us_;
+    // the next tick to expire
+    uint64_t now_;
+    int64_t last_us_;
+    int count_;
+    TimerNode slots_[RS_TIMER_WHEEL_LEVELS][RS_TIMER_WHEEL_SLOTS];
+    st_cond_t cond_;
+    bool waiting_;
+    internal::Thread *thread_;
+};
+
+extern thread_local TimingWheel *_wheel;
+
+#endif
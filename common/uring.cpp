@@ -0,0 +1,449 @@
+#include <common/uring.hpp>
+
+#ifdef RS_IO_URING
+
+#include <common/error.hpp>
+#include <common/log.hpp>
+#include <common/utils.hpp>
+
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+
+Uring::Uring()
+{
+    event_fd_ = -1;
+    event_stfd_ = nullptr;
+    nb_prepared_ = 0;
+    submit_cond_ = st_cond_new();
+    submit_waiting_ = false;
+    reap_thread_ = new internal::Thread("uring-reap", this, 0, false);
+    submitter_ = nullptr;
+    submit_thread_ = nullptr;
+    buffers_ = nullptr;
+    nb_syscalls_ = 0;
+}
+
+Uring::~Uring()
+{
+    rs_freep(reap_thread_);
+    rs_freep(submit_thread_);
+    rs_freep(submitter_);
+    rs_freepa(buffers_);
+    st_cond_destroy(submit_cond_);
+}
+
+UringSubmitter::UringSubmitter(Uring *uring) : uring_(uring)
+{
+}
+
+UringSubmitter::~UringSubmitter()
+{
+}
+
+int32_t UringSubmitter::Cycle()
+{
+    if (uring_->nb_prepared_ == 0)
+    {
+        uring_->submit_waiting_ = true;
+        st_cond_wait(uring_->submit_cond_);
+        uring_->submit_waiting_ = false;
+    }
+
+    // the signaled coroutines prepared their sqes before we run, submit them together
+    if (uring_->nb_prepared_ > 0)
+    {
+        uring_->submit();
+    }
+    return ERROR_SUCCESS;
+}
+
+int32_t Uring::Initialize(int entries)
+{
+    int32_t ret = ERROR_SUCCESS;
+
+    if (io_uring_queue_init(entries, &ring_, 0) < 0)
+    {
+        ret = ERROR_SYSTEM_URING;
+        rs_error("io_uring init failed, entries=%d, errno=%d, ret=%d", entries, errno, ret);
+        return ret;
+    }
+
+    if ((event_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0 || io_uring_register_eventfd(&ring_, event_fd_) < 0)
+    {
+        ret = ERROR_SYSTEM_URING;
+        rs_error("io_uring register eventfd failed, errno=%d, ret=%d", errno, ret);
+        return ret;
+    }
+
+    if ((event_stfd_ = st_netfd_open(event_fd_)) == nullptr)
+    {
+        ret = ERROR_ST_OPEN_SOCKET;
+        rs_error("open io_uring eventfd failed, ret=%d", ret);
+        return ret;
+    }
+
+    // register the buffers of the sends, the kernel needs not map pages for each send
+    buffers_ = new char[RS_URING_FIXED_BUFFERS * RS_URING_FIXED_BUFFER_SIZE];
+    std::vector<iovec> iovs(RS_URING_FIXED_BUFFERS);
+    for (int i = 0; i < RS_URING_FIXED_BUFFERS; i++)
+    {
+        iovs[i].iov_base = buffers_ + i * RS_URING_FIXED_BUFFER_SIZE;
+        iovs[i].iov_len = RS_URING_FIXED_BUFFER_SIZE;
+        free_buffers_.push_back(i);
+    }
+    if (io_uring_register_buffers(&ring_, &iovs[0], RS_URING_FIXED_BUFFERS) < 0)
+    {
+        rs_warn("io_uring register buffers failed, send without fixed buffers, errno=%d", errno);
+        free_buffers_.clear();
+    }
+
+    submitter_ = new UringSubmitter(this);
+    submit_thread_ = new internal::Thread("uring-submit", submitter_, 0, false);
+    if ((ret = submit_thread_->Start()) != ERROR_SUCCESS)
+    {
+        rs_error("start io_uring submit thread failed, ret=%d", ret);
+        return ret;
+    }
+
+    if ((ret = reap_thread_->Start()) != ERROR_SUCCESS)
+    {
+        rs_error("start io_uring reap thread failed, ret=%d", ret);
+        return ret;
+    }
+
+    rs_trace("io_uring started, entries=%d, fixed_buffers=%d", entries, (int)free_buffers_.size());
+    return ret;
+}
+
+int Uring::submit()
+{
+    nb_prepared_ = 0;
+    nb_syscalls_++;
+    return io_uring_submit(&ring_);
+}
+
+io_uring_sqe *Uring::GetSqe()
+{
+    io_uring_sqe *sqe = io_uring_get_sqe(&ring_);
+    if (!sqe)
+    {
+        submit();
+        sqe = io_uring_get_sqe(&ring_);
+    }
+    rs_assert(sqe);
+
+    if (nb_prepared_++ == 0 && submit_waiting_)
+    {
+        st_cond_signal(submit_cond_);
+    }
+    return sqe;
+}
+
+void Uring::Wait(UringRequest *req)
+{
+    bool canceled = false;
+    while (!req->done)
+    {
+        // the request refers to the memory of caller, never return before it completes
+        if (st_cond_wait(req->cond) == -1 && errno == EINTR && !canceled)
+        {
+            io_uring_sqe *sqe = GetSqe();
+            io_uring_prep_cancel(sqe, req, 0);
+            io_uring_sqe_set_data(sqe, nullptr);
+            canceled = true;
+        }
+    }
+}
+
+int Uring::AcquireBuffer(char **pbuf)
+{
+    if (free_buffers_.empty())
+    {
+        return -1;
+    }
+    int index = free_buffers_.back();
+    free_buffers_.pop_back();
+    *pbuf = buffers_ + index * RS_URING_FIXED_BUFFER_SIZE;
+    return index;
+}
+
+void Uring::ReleaseBuffer(int index)
+{
+    free_buffers_.push_back(index);
+}
+
+int64_t Uring::GetSyscalls()
+{
+    return nb_syscalls_;
+}
+
+int32_t Uring::Cycle()
+{
+    int32_t ret = ERROR_SUCCESS;
+
+    uint64_t v;
+    if (st_read(event_stfd_, &v, sizeof(v), ST_UTIME_NO_TIMEOUT) <= 0)
+    {
+        return ret;
+    }
+
+    io_uring_cqe *cqe = nullptr;
+    while (io_uring_peek_cqe(&ring_, &cqe) == 0)
+    {
+        UringRequest *req = (UringRequest *)io_uring_cqe_get_data(cqe);
+        if (req)
+        {
+            req->res = cqe->res;
+            req->done = true;
+            st_cond_signal(req->cond);
+        }
+        io_uring_cqe_seen(&ring_, cqe);
+    }
+
+    return ret;
+}
+
+UringSocket::UringSocket(st_netfd_t stfd) : fd_(st_netfd_fileno(stfd)),
+                                           send_timeout_(ST_UTIME_NO_TIMEOUT),
+                                           recv_timeout_(ST_UTIME_NO_TIMEOUT),
+                                           send_bytes_(0),
+                                           recv_bytes_(0)
+{
+    // io_uring returns EAGAIN for the nonblocking fd, it polls internally for the blocking one
+    int flags = ::fcntl(fd_, F_GETFL, 0);
+    ::fcntl(fd_, F_SETFL, flags & ~O_NONBLOCK);
+}
+
+UringSocket::~UringSocket()
+{
+}
+
+bool UringSocket::IsNeverTimeout(int64_t timeout_us)
+{
+    return timeout_us == (int64_t)ST_UTIME_NO_TIMEOUT;
+}
+
+void UringSocket::SetRecvTimeout(int64_t timeout_us)
+{
+    recv_timeout_ = timeout_us;
+}
+
+int64_t UringSocket::GetRecvTimeout()
+{
+    return recv_timeout_;
+}
+
+void UringSocket::SetSendTimeout(int64_t timeout_us)
+{
+    send_timeout_ = timeout_us;
+}
+
+int64_t UringSocket::GetSendTimeout()
+{
+    return send_timeout_;
+}
+
+int64_t UringSocket::GetSendBytes()
+{
+    return send_bytes_;
+}
+
+int64_t UringSocket::GetRecvBytes()
+{
+    return recv_bytes_;
+}
+
+void UringSocket::link_timeout(int64_t timeout_us, __kernel_timespec *ts)
+{
+    ts->tv_sec = timeout_us / 1000000;
+    ts->tv_nsec = (timeout_us % 1000000) * 1000;
+    io_uring_sqe *sqe = _uring->GetSqe();
+    io_uring_prep_link_timeout(sqe, ts, 0);
+    io_uring_sqe_set_data(sqe, nullptr);
+}
+
+int UringSocket::do_readv(const struct iovec *iov, int iov_size)
+{
+    UringRequest req;
+    req.cond = st_cond_new();
+    req.res = 0;
+    req.done = false;
+
+    // the kernel copies to the buffers of caller, once, like the readv of st
+    io_uring_sqe *sqe = _uring->GetSqe();
+    io_uring_prep_readv(sqe, fd_, iov, iov_size, 0);
+    io_uring_sqe_set_data(sqe, &req);
+
+    __kernel_timespec ts;
+    if (!IsNeverTimeout(recv_timeout_))
+    {
+        sqe->flags |= IOSQE_IO_LINK;
+        link_timeout(recv_timeout_, &ts);
+    }
+
+    _uring->Wait(&req);
+    st_cond_destroy(req.cond);
+
+    return req.res;
+}
+
+int UringSocket::do_writev(const struct iovec *iov, int iov_size)
+{
+    UringRequest req;
+    req.cond = st_cond_new();
+    req.res = 0;
+    req.done = false;
+
+    io_uring_sqe *sqe = _uring->GetSqe();
+    io_uring_prep_writev(sqe, fd_, iov, iov_size, 0);
+    io_uring_sqe_set_data(sqe, &req);
+
+    __kernel_timespec ts;
+    if (!IsNeverTimeout(send_timeout_))
+    {
+        sqe->flags |= IOSQE_IO_LINK;
+        link_timeout(send_timeout_, &ts);
+    }
+
+    _uring->Wait(&req);
+    st_cond_destroy(req.cond);
+
+    return req.res;
+}
+
+int32_t UringSocket::Read(void *buf, size_t size, ssize_t *nread)
+{
+    iovec iov;
+    iov.iov_base = buf;
+    iov.iov_len = size;
+    return ReadEv(&iov, 1, nread);
+}
+
+int32_t UringSocket::ReadEv(const struct iovec *iov, int iov_size, ssize_t *nread)
+{
+    size_t size = 0;
+    for (int i = 0; i < iov_size; i++)
+    {
+        size += iov[i].iov_len;
+    }
+    if (size == 0)
+    {
+        if (nread)
+        {
+            *nread = 0;
+        }
+        return ERROR_SUCCESS;
+    }
+
+    int res = do_readv(iov, iov_size);
+    if (nread)
+    {
+        *nread = res;
+    }
+
+    if (res <= 0)
+    {
+        if (res == -ECANCELED || res == -ETIME)
+        {
+            return ERROR_SOCKET_TIMEOUT;
+        }
+        errno = res == 0 ? ECONNRESET : -res;
+        return ERROR_SOCKET_READ;
+    }
+
+    recv_bytes_ += res;
+    return ERROR_SUCCESS;
+}
+
+int32_t UringSocket::ReadFully(void *buf, size_t size, ssize_t *nread)
+{
+    int32_t ret = ERROR_SUCCESS;
+
+    size_t left = size;
+    while (left > 0)
+    {
+        ssize_t nb_read = 0;
+        if ((ret = Read((char *)buf + size - left, left, &nb_read)) != ERROR_SUCCESS)
+        {
+            if (nread)
+            {
+                *nread = size - left;
+            }
+            return ret;
+        }
+        left -= nb_read;
+    }
+
+    if (nread)
+    {
+        *nread = size;
+    }
+    return ret;
+}
+
+int32_t UringSocket::Write(void *buf, size_t size, ssize_t *nwrite)
+{
+    iovec iov;
+    iov.iov_base = buf;
+    iov.iov_len = size;
+    return WriteEv(&iov, 1, nwrite);
+}
+
+int32_t UringSocket::WriteEv(const struct iovec *iov, size_t iov_size, ssize_t *nwrite)
+{
+    size_t total = 0;
+    for (size_t i = 0; i < iov_size; i++)
+    {
+        total += iov[i].iov_len;
+    }
+
+    // like st_writev, write all the iovs, the partial write continues from the offset
+    std::vector<iovec> left(iov, iov + iov_size);
+    iovec *p = &left[0];
+    int nb_left = (int)iov_size;
+    size_t written = 0;
+
+    while (written < total)
+    {
+        int res = do_writev(p, nb_left);
+        if (res <= 0)
+        {
+            if (nwrite)
+            {
+                *nwrite = written;
+            }
+            if (res == -ECANCELED || res == -ETIME)
+            {
+                return ERROR_SOCKET_TIMEOUT;
+            }
+            errno = -res;
+            return ERROR_SOCKET_WRITE;
+        }
+
+        written += res;
+        send_bytes_ += res;
+
+        size_t n = res;
+        while (nb_left > 0 && n >= p->iov_len)
+        {
+            n -= p->iov_len;
+            p++;
+            nb_left--;
+        }
+        if (nb_left > 0)
+        {
+            p->iov_base = (char *)p->iov_base + n;
+            p->iov_len -= n;
+        }
+    }
+
+    if (nwrite)
+    {
+        *nwrite = written;
+    }
+    return ERROR_SUCCESS;
+}
+
+#endif
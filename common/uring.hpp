@@ -0,0 +1,128 @@
+#ifndef RS_URING_HPP
+#define RS_URING_HPP
+
+#include <common/core.hpp>
+#include <common/io.hpp>
+#include <common/thread.hpp>
+
+#ifdef RS_IO_URING
+
+#include <liburing.h>
+#include <st.h>
+#include <vector>
+
+// the registered buffers for the sends built in place, the reads go to the caller
+// buffers directly
+#define RS_URING_FIXED_BUFFERS 256
+#define RS_URING_FIXED_BUFFER_SIZE (64 * 1024)
+
+class Uring;
+
+struct UringRequest
+{
+    st_cond_t cond;
+    int res;
+    bool done;
+};
+
+// the submit coroutine, runs after the coroutines of the current loop prepared sqes
+class UringSubmitter : public internal::IThreadHandler
+{
+public:
+    UringSubmitter(Uring *uring);
+    virtual ~UringSubmitter();
+
+public:
+    // internal::IThreadHandler
+    virtual int32_t Cycle() override;
+
+private:
+    Uring *uring_;
+};
+
+/**
+ * the io_uring of the st process. the sqes prepared by coroutines in one loop of st are
+ * submitted together by the submit coroutine, the completions are reaped by the reap
+ * coroutine when the eventfd of the ring is readable, which wakes up the waiting coroutine.
+ */
+class Uring : public internal::IThreadHandler
+{
+    friend class UringSubmitter;
+public:
+    Uring();
+    virtual ~Uring();
+
+public:
+    virtual int32_t Initialize(int entries);
+    // get a sqe, submit the prepared sqes when the sq is full
+    virtual io_uring_sqe *GetSqe();
+    // wait the request until completed, the request is canceled when interrupted
+    virtual void Wait(UringRequest *req);
+    // a registered buffer, -1 when all in use
+    virtual int AcquireBuffer(char **pbuf);
+    virtual void ReleaseBuffer(int index);
+    // internal::IThreadHandler
+    virtual int32_t Cycle() override;
+    // the syscalls of submit and reap
+    virtual int64_t GetSyscalls();
+
+private:
+    int submit();
+
+private:
+    io_uring ring_;
+    int event_fd_;
+    st_netfd_t event_stfd_;
+    int nb_prepared_;
+    // the submit coroutine waits for the prepared sqes
+    st_cond_t submit_cond_;
+    bool submit_waiting_;
+    internal::Thread *reap_thread_;
+    UringSubmitter *submitter_;
+    internal::Thread *submit_thread_;
+    char *buffers_;
+    std::vector<int> free_buffers_;
+    int64_t nb_syscalls_;
+};
+
+extern thread_local Uring *_uring;
+
+class UringSocket : public IProtocolReaderWriter
+{
+public:
+    UringSocket(st_netfd_t client_stfd);
+    virtual ~UringSocket();
+
+public:
+    virtual bool IsNeverTimeout(int64_t timeout_us) override;
+    virtual void SetRecvTimeout(int64_t timeout_us) override;
+    virtual int64_t GetRecvTimeout() override;
+    virtual void SetSendTimeout(int64_t timeout_us) override;
+    virtual int64_t GetSendTimeout() override;
+    virtual int64_t GetSendBytes() override;
+    virtual int64_t GetRecvBytes() override;
+
+public:
+    virtual int32_t Read(void *buf, size_t size, ssize_t *nread) override;
+    virtual int32_t ReadFully(void *buf, size_t size, ssize_t *nread) override;
+    virtual int32_t ReadEv(const struct iovec *iov, int iov_size, ssize_t *nread) override;
+    virtual int32_t Write(void *buf, size_t size, ssize_t *nread) override;
+    virtual int32_t WriteEv(const struct iovec *iov, size_t iov_size, ssize_t *nwrite) override;
+
+private:
+    // read to the iovs of caller, a short read is allowed
+    int do_readv(const struct iovec *iov, int iov_size);
+    int do_writev(const struct iovec *iov, int iov_size);
+    void link_timeout(int64_t timeout_us, __kernel_timespec *ts);
+
+private:
+    int fd_;
+    int64_t send_timeout_;
+    int64_t recv_timeout_;
+    int64_t send_bytes_;
+    int64_t recv_bytes_;
+};
+
+#endif
+
+#endif
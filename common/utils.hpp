@@ -24,7 +24,7 @@
 #define rs_freepa(pa) \
     if (pa)         \
     {                 \
-        delete pa;    \
+        delete[] pa;  \
         pa = nullptr; \
     }                 \
     (void)0           \
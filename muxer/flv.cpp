@@ -212,17 +212,12 @@ int FlvMuxer::write_tag_header_to_cache(char type, int size, int timestamp, char
 
     timestamp &= 0x7fffffff;
 
-    BufferManager  manager;
-    if (manager.Initialize(cache, 11) != ERROR_SUCCESS)
-    {
-        return ret;
-    }
-
-    manager.Write1Bytes(type);
-    manager.Write3Bytes(size);
-    manager.Write3Bytes(type);
-    manager.Write1Bytes((timestamp>>24) & 0xff);
-    manager.Write3Bytes(0x00);
+    ByteWriter writer(cache, FLV_TAG_HEADER_SIZE);
+    writer.Write1(type);
+    writer.Write3(size);
+    writer.Write3(timestamp);
+    writer.Write1((timestamp>>24) & 0xff);
+    writer.Write3(0x00);
 
     return ret;
 }
@@ -230,13 +225,7 @@ int FlvMuxer::write_tag_header_to_cache(char type, int size, int timestamp, char
 int FlvMuxer::write_previous_tag_size_to_cache(int size, char *cache)
 {
     int ret = ERROR_SUCCESS;
-    BufferManager manager;
-    if ((ret = manager.Initialize(cache, size)) != ERROR_SUCCESS)
-    {
-        return ret;
-    }
-
-    manager.Write4Bytes(size);
+    bytes::Write4(cache, size);
     return ret;
 }
 
@@ -343,7 +332,7 @@ int FlvMuxer::WriteTags(rtmp::SharedPtrMessage **msgs, int count)
 
     if (nb_iovss_cache_ < nb_iovss)
     {
-        rs_freep(iovss_cache_);
+        rs_freepa(iovss_cache_);
         nb_iovss_cache_ = nb_iovss;
         iovss_cache_ = iovss = new iovec[nb_iovss];
     }
@@ -353,7 +342,7 @@ int FlvMuxer::WriteTags(rtmp::SharedPtrMessage **msgs, int count)
     {
         rs_freepa(tag_headers_);
         nb_tag_headers_ = count;
-        tag_headers_ = cache = new char(FLV_TAG_HEADER_SIZE * count);
+        tag_headers_ = cache = new char[FLV_TAG_HEADER_SIZE * count];
     }
 
     char *pts = ppts_;
@@ -46,7 +46,7 @@ int GopCache::Cache(SharedPtrMessage* shared_msg)
 
 	SharedPtrMessage * msg = shared_msg;
 	if (msg->IsVideo()) {
-		if (!FlvDemuxer::IsKeyFrame(msg->payload, msg->size))
+		if (FlvDemuxer::IsKeyFrame(msg->payload, msg->size))
 		{
 			rs_info("clear gop cache when got keyframe. vcount=%d, count=%d", cached_video_count_, (int)queue_.size());
 			Clear();
@@ -87,6 +87,11 @@ int GopCache::Dump(Consumer* consumer, bool atc, JitterAlgorithm ag)
 	return ret;
 }
 
+void GopCache::Snapshot(std::vector<SharedPtrMessage*> &msgs)
+{
+	msgs = queue_;
+}
+
 void GopCache::Clear()
 {
 	std::vector<SharedPtrMessage*>::iterator it;
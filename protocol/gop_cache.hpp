@@ -22,6 +22,8 @@ public:
 	virtual int Cache(SharedPtrMessage* shared_msg);
 	virtual void Clear();
 	virtual int Dump(Consumer* consumer, bool atc, JitterAlgorithm jitter_ag);
+	// the cached messages, still owned by the cache
+	virtual void Snapshot(std::vector<SharedPtrMessage*> &msgs);
 	virtual bool Empty();
 	virtual int64_t StartTime();
 	virtual bool PureAudio();
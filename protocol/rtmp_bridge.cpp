@@ -0,0 +1,234 @@
+#include <protocol/rtmp_bridge.hpp>
+#include <protocol/rtmp_consts.hpp>
+#include <protocol/rtmp_message.hpp>
+#include <protocol/rtmp_source.hpp>
+#include <common/error.hpp>
+#include <common/log.hpp>
+#include <common/st.hpp>
+#include <common/utils.hpp>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace rtmp
+{
+
+SourceBridge::SourceBridge(Source *relay) : relay_(relay),
+                                            wakeup_stfd_(nullptr),
+                                            thread_(nullptr),
+                                            dropping_(false)
+{
+    tid_ = ::pthread_self();
+    queue_ = new SPSCQueue<SharedPtrMessage *>(RTMP_BRIDGE_QUEUE_SIZE);
+    sleeping_.store(false);
+    nb_dropped_.store(0);
+    wakeup_[0] = wakeup_[1] = -1;
+}
+
+SourceBridge::~SourceBridge()
+{
+    if (thread_)
+    {
+        thread_->Stop();
+    }
+    rs_freep(thread_);
+
+    SharedPtrMessage *msg = nullptr;
+    while (queue_->Pop(msg))
+    {
+        rs_freep(msg);
+    }
+    rs_freep(queue_);
+
+    STCloseFd(wakeup_stfd_);
+    if (wakeup_[1] >= 0)
+    {
+        ::close(wakeup_[1]);
+    }
+}
+
+int32_t SourceBridge::Initialize()
+{
+    int32_t ret = ERROR_SUCCESS;
+
+    if (::pipe(wakeup_) < 0)
+    {
+        ret = ERROR_SYSTEM_CREATE_PIPE;
+        rs_error("create bridge wakeup pipe failed, ret=%d", ret);
+        return ret;
+    }
+    int flags = ::fcntl(wakeup_[1], F_GETFL, 0);
+    ::fcntl(wakeup_[1], F_SETFL, flags | O_NONBLOCK);
+
+    if ((wakeup_stfd_ = st_netfd_open(wakeup_[0])) == nullptr)
+    {
+        ret = ERROR_ST_OPEN_SOCKET;
+        rs_error("open bridge wakeup pipe failed, ret=%d", ret);
+        return ret;
+    }
+
+    thread_ = new internal::Thread("bridge", this, 0, false);
+    if ((ret = thread_->Start()) != ERROR_SUCCESS)
+    {
+        rs_error("start bridge thread failed, ret=%d", ret);
+        return ret;
+    }
+
+    return ret;
+}
+
+bool SourceBridge::IsLocal()
+{
+    return ::pthread_equal(tid_, ::pthread_self());
+}
+
+void SourceBridge::Push(SharedPtrMessage *msg, bool droppable, bool is_keyframe)
+{
+    if (is_keyframe)
+    {
+        dropping_ = false;
+    }
+
+    if (dropping_ && droppable)
+    {
+        nb_dropped_++;
+        rs_freep(msg);
+        return;
+    }
+
+    msg->Share();
+    if (!queue_->Push(msg))
+    {
+        if (!dropping_)
+        {
+            rs_warn("bridge queue full, drop until next keyframe, dropped=%lld", nb_dropped_.load());
+        }
+        dropping_ = true;
+        nb_dropped_++;
+        rs_freep(msg);
+        return;
+    }
+
+    // pairs with the fence of consumer, one of us must see the other
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping_.exchange(false))
+    {
+        char c = 0;
+        ::write(wakeup_[1], &c, 1);
+    }
+}
+
+int64_t SourceBridge::GetDroppedFrames()
+{
+    return nb_dropped_.load();
+}
+
+int32_t SourceBridge::Cycle()
+{
+    int32_t ret = ERROR_SUCCESS;
+
+    SharedPtrMessage *msg = nullptr;
+    while (queue_->Pop(msg))
+    {
+        if ((ret = relay_->OnRelay(msg)) != ERROR_SUCCESS)
+        {
+            rs_warn("relay message failed, ignore it. ret=%d", ret);
+            ret = ERROR_SUCCESS;
+        }
+        rs_freep(msg);
+    }
+
+    sleeping_.store(true);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!queue_->Empty())
+    {
+        sleeping_.store(false);
+        return ret;
+    }
+
+    char buf[64];
+    st_read(wakeup_stfd_, buf, sizeof(buf), ST_UTIME_NO_TIMEOUT);
+    sleeping_.store(false);
+
+    return ret;
+}
+
+SourceHub::SourceHub()
+{
+}
+
+SourceHub::~SourceHub()
+{
+}
+
+HubStream *SourceHub::fetch_or_create(const std::string &stream_url)
+{
+    std::map<std::string, HubStream *>::iterator it = streams_.find(stream_url);
+    if (it != streams_.end())
+    {
+        return it->second;
+    }
+
+    HubStream *stream = new HubStream;
+    stream->owner = nullptr;
+    stream->version.store(0);
+    streams_[stream_url] = stream;
+    return stream;
+}
+
+int SourceHub::Publish(const std::string &stream_url, Source *s, HubStream **pstream)
+{
+    int ret = ERROR_SUCCESS;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    HubStream *stream = fetch_or_create(stream_url);
+    if (stream->owner && stream->owner != s)
+    {
+        ret = ERROR_SYSTEM_STREAM_BUSY;
+        rs_warn("stream %s is published by other thread, ret=%d", stream_url.c_str(), ret);
+        return ret;
+    }
+
+    stream->owner = s;
+    // the new owner primes all bridges
+    stream->version++;
+    *pstream = stream;
+
+    return ret;
+}
+
+void SourceHub::Unpublish(HubStream *stream, Source *s)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stream->owner != s)
+    {
+        rs_warn("unpublish stream not owned, ignore it");
+        return;
+    }
+    stream->owner = nullptr;
+}
+
+void SourceHub::Subscribe(const std::string &stream_url, SourceBridge *bridge)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    HubStream *stream = fetch_or_create(stream_url);
+    stream->bridges.push_back(bridge);
+    stream->version++;
+}
+
+bool SourceHub::Update(HubStream *stream, int &version, std::vector<SourceBridge *> &bridges)
+{
+    if (stream->version.load(std::memory_order_acquire) == version)
+    {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    version = stream->version.load();
+    bridges = stream->bridges;
+    return true;
+}
+
+} // namespace rtmp
@@ -0,0 +1,98 @@
+#ifndef RS_RTMP_BRIDGE_HPP
+#define RS_RTMP_BRIDGE_HPP
+
+#include <common/core.hpp>
+#include <common/queue.hpp>
+#include <common/thread.hpp>
+
+#include <pthread.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace rtmp
+{
+
+class Source;
+class SharedPtrMessage;
+
+/**
+ * the messages from the source of the publisher thread to the relay source of another
+ * scheduler thread, by the lock free spsc queue. the payloads are shared by the atomic
+ * refcount, never copied.
+ * pushed by the publisher thread, consumed by the coroutine of the relay thread, which
+ * is waked up by a pipe when it sleeps.
+ */
+class SourceBridge : public internal::IThreadHandler
+{
+public:
+    // by the relay thread
+    SourceBridge(Source *relay);
+    virtual ~SourceBridge();
+
+public:
+    virtual int32_t Initialize();
+    virtual bool IsLocal();
+    // by the publisher thread, the bridge takes the ownership of msg
+    virtual void Push(SharedPtrMessage *msg, bool droppable, bool is_keyframe);
+    virtual int64_t GetDroppedFrames();
+    // internal::IThreadHandler
+    virtual int32_t Cycle() override;
+
+private:
+    Source *relay_;
+    pthread_t tid_;
+    SPSCQueue<SharedPtrMessage *> *queue_;
+    std::atomic<bool> sleeping_;
+    int wakeup_[2];
+    st_netfd_t wakeup_stfd_;
+    internal::Thread *thread_;
+    // by the publisher thread, drop until the next keyframe when queue is full
+    bool dropping_;
+    std::atomic<int64_t> nb_dropped_;
+};
+
+// the stream of all scheduler threads, the owner is the source of publisher thread
+struct HubStream
+{
+    Source *owner;
+    std::vector<SourceBridge *> bridges;
+    // changed when bridge subscribed, checked by the owner for each message
+    std::atomic<int> version;
+};
+
+/**
+ * the streams shared by the scheduler threads. the hub is locked only when publish,
+ * unpublish and subscribe, the owner checks the version without lock.
+ * the streams and bridges are never freed, like the source pool.
+ */
+class SourceHub
+{
+public:
+    SourceHub();
+    virtual ~SourceHub();
+
+public:
+    // fails when published by other thread
+    virtual int Publish(const std::string &stream_url, Source *s, HubStream **pstream);
+    // only the owner releases the stream
+    virtual void Unpublish(HubStream *stream, Source *s);
+    virtual void Subscribe(const std::string &stream_url, SourceBridge *bridge);
+    // by the owner, copy the bridges when changed, return false when not changed
+    virtual bool Update(HubStream *stream, int &version, std::vector<SourceBridge *> &bridges);
+
+private:
+    HubStream *fetch_or_create(const std::string &stream_url);
+
+private:
+    std::mutex mutex_;
+    std::map<std::string, HubStream *> streams_;
+};
+
+} // namespace rtmp
+
+extern rtmp::SourceHub *_hub;
+
+#endif
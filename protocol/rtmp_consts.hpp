@@ -36,12 +36,30 @@
 #define RTMP_MR_MSGS 128
 #define RTMP_MR_MIN_MSGS 8
 #define RTMP_MR_SLEEP_MS 350
+// max messages of the source fan-out ring, must be power of 2
+#define RTMP_SOURCE_RING_SIZE 8192
+// max messages in flight from the publisher thread to a relay thread
+#define RTMP_BRIDGE_QUEUE_SIZE 4096
+// interval to sample the consumer wakeups
+#define RTMP_WAKEUP_SAMPLE_MS 10000
 #define RTMP_IOVS_MAX (RTMP_MR_MSGS * 2)
 #define RTMP_C0C3_HEADERS_MAX (RTMP_MR_MSGS * 32)
+// the chunked wire format variants cached by a shared payload
+#define RTMP_WIRE_CACHE_VARIANTS 2
+// interval to reap the zerocopy pins of the freed connections
+#define RTMP_ZEROCOPY_REAP_INTERVAL_MS 100
+// the zerocopy pins of a dead peer are released after the tcp user timeout
+#define RTMP_ZEROCOPY_USER_TIMEOUT_MS 30000
 
 
 // rtmp fmt0 header size(max base header)
 #define RTMP_FMT0_HEADER_SIZE 16
+// fmt0 header without extended timestamp
+#define RTMP_FMT0_SHORT_HEADER_SIZE 12
+// the max timestamp and delta of the 3 bytes field
+#define RTMP_TIMESTAMP_24BIT_MAX 0xffffff
+// the chunk streams of 1 byte basic header, the egress delta headers state
+#define RTMP_OUT_CHUNK_STREAMS 64
 
 // rtmp message header type
 #define RTMP_FMT_TYPE0 0
@@ -81,6 +99,8 @@
 #define RTMP_MSG_AMF3_SHARED_OBJ 0x10
 #define RTMP_MSG_AMF0_SHARED_OBJ 0x13
 #define RTMP_MSG_AGGREGATE 0x16
+// the flv tag header of the sub message in aggregate
+#define RTMP_AGGREGATE_TAG_HEADER_SIZE 11
 
 // amf0 command message
 #define RTMP_AMF0_COMMAND_CONNECT "connect"
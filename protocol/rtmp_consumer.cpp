@@ -1,8 +1,13 @@
 #include <protocol/rtmp_source.hpp>
 #include <protocol/rtmp_message.hpp>
 #include <common/error.hpp>
+#include <common/utils.hpp>
+#include <common/clock.hpp>
 #include <protocol/rtmp_consumer.hpp>
 
+#include <algorithm>
+#include <poll.h>
+
 namespace rtmp
 {
 
@@ -14,6 +19,124 @@ IWakeable::~IWakeable()
 {
 }
 
+WakeupScheduler::WakeupScheduler() : tick_ms_(0),
+                                     waiting_(false),
+                                     thread_(nullptr),
+                                     nb_wakeups_(0),
+                                     nb_ticks_(0),
+                                     sample_time_(0),
+                                     sample_wakeups_(0),
+                                     wakeups_per_second_(0)
+{
+    cond_ = st_cond_new();
+}
+
+WakeupScheduler::~WakeupScheduler()
+{
+    if (thread_)
+    {
+        thread_->Stop();
+    }
+    rs_freep(thread_);
+    st_cond_destroy(cond_);
+}
+
+int32_t WakeupScheduler::Initialize(int tick_ms)
+{
+    int32_t ret = ERROR_SUCCESS;
+
+    tick_ms_ = tick_ms;
+    sample_time_ = _clock->SteadyMS();
+    if (tick_ms_ <= 0)
+    {
+        return ret;
+    }
+
+    thread_ = new internal::Thread("wakeup", this, 0, false);
+    if ((ret = thread_->Start()) != ERROR_SUCCESS)
+    {
+        rs_error("start wakeup scheduler failed, ret=%d", ret);
+        return ret;
+    }
+
+    rs_trace("wakeup scheduler started, tick=%dms", tick_ms_);
+    return ret;
+}
+
+void WakeupScheduler::Schedule(Consumer *consumer)
+{
+    if (!thread_)
+    {
+        consumer->OnWakeup();
+        sample(1);
+        return;
+    }
+
+    ready_.push_back(consumer);
+    if (waiting_)
+    {
+        waiting_ = false;
+        st_cond_signal(cond_);
+    }
+}
+
+void WakeupScheduler::Cancel(Consumer *consumer)
+{
+    std::vector<Consumer *>::iterator it = std::find(ready_.begin(), ready_.end(), consumer);
+    if (it != ready_.end())
+    {
+        ready_.erase(it);
+    }
+}
+
+double WakeupScheduler::GetWakeupsPerSecond()
+{
+    return wakeups_per_second_;
+}
+
+int32_t WakeupScheduler::Cycle()
+{
+    // never tick when no consumer ready
+    if (ready_.empty())
+    {
+        waiting_ = true;
+        st_cond_wait(cond_);
+        waiting_ = false;
+    }
+
+    // collect the consumers ready in the tick
+    st_usleep(tick_ms_ * 1000);
+
+    std::vector<Consumer *> ready;
+    ready.swap(ready_);
+    for (size_t i = 0; i < ready.size(); i++)
+    {
+        ready[i]->OnWakeup();
+    }
+
+    nb_ticks_++;
+    sample((int)ready.size());
+    return ERROR_SUCCESS;
+}
+
+void WakeupScheduler::sample(int nb_wakeups)
+{
+    nb_wakeups_ += nb_wakeups;
+
+    int64_t now = _clock->SteadyMS();
+    int64_t elapsed = now - sample_time_;
+    if (elapsed < RTMP_WAKEUP_SAMPLE_MS)
+    {
+        return;
+    }
+
+    wakeups_per_second_ = (nb_wakeups_ - sample_wakeups_) * 1000.0 / elapsed;
+    sample_time_ = now;
+    sample_wakeups_ = nb_wakeups_;
+
+    rs_trace("consumer wakeups=%.1f/s, total=%lld, ticks=%lld", wakeups_per_second_, nb_wakeups_, nb_ticks_);
+}
+
 Consumer::Consumer(Source *s, Connection *c)
 {
     source_ = s;
@@ -21,15 +144,26 @@ Consumer::Consumer(Source *s, Connection *c)
     pause_ = false;
     jitter_ = new Jitter;
     queue_ = new MessageQueue;
+    ring_ = s->GetRing();
+    cursor_ = ring_->Head();
+    nb_skipped_frames_ = 0;
+    should_update_source_id_ = false;
     mw_wait_ = st_cond_new();
     mw_waiting_ = false;
+    mw_scheduled_ = false;
+    mw_poller_ = nullptr;
     mw_min_msgs_ = 0;
     mw_duration_ = 0;
 }
 
 Consumer::~Consumer()
 {
+    rs_trace("consumer destroyed, dropped_frames=%lld, shrinks=%lld", GetDroppedFrames(), queue_->GetShrinks());
     source_->OnConsumerDestory(this);
+    if (mw_scheduled_)
+    {
+        _wakeup->Cancel(this);
+    }
     rs_freep(jitter_);
     rs_freep(queue_);
     st_cond_destroy(mw_wait_);
@@ -67,7 +201,7 @@ int Consumer::Enqueue(SharedPtrMessage *shared_msg, bool atc, JitterAlgorithm ag
     if (mw_waiting_)
     {
         int duration_ms = queue_->Duration();
-        bool match_min_msgs = queue_->Size() - mw_min_msgs_;
+        bool match_min_msgs = queue_->Size() > mw_min_msgs_;
 
         //for atc,maybe the sequeue header timestamp bigger than AV packet
         //when encode republish or overflow
@@ -106,14 +240,110 @@ int Consumer::DumpPackets(MessageArray *msg_arr, int &count)
         return ret;
     }
 
+    // lagging behind the ring, skip to the latest keyframe with the current sequence headers
+    if (cursor_ < ring_->Tail())
+    {
+        int64_t seq = ring_->KeyFrame();
+        if (seq < ring_->Tail())
+        {
+            seq = ring_->Head();
+        }
+        rs_warn("consumer lagging, skip %lld messages", seq - cursor_);
+        nb_skipped_frames_ += seq - cursor_;
+        cursor_ = seq;
+
+        if ((ret = source_->DumpSequenceHeaders(this)) != ERROR_SUCCESS)
+        {
+            return ret;
+        }
+    }
+
     if ((ret  = queue_->DumpPackets(max, msg_arr->msgs, count)) != ERROR_SUCCESS)
     {
         return ret;
     }
 
+    if (count < max)
+    {
+        int nb_msgs = 0;
+        ret = dump_ring(msg_arr->msgs + count, max - count, nb_msgs);
+        count += nb_msgs;
+    }
+
+    return ret;
+}
+
+int Consumer::dump_ring(SharedPtrMessage **pmsgs, int max, int &count)
+{
+    int ret = ERROR_SUCCESS;
+
+    bool atc = source_->IsATC();
+    JitterAlgorithm ag = source_->GetJitterAlgorithm();
+
+    count = 0;
+    while (count < max && cursor_ < ring_->Head())
+    {
+        SharedPtrMessage *msg = ring_->At(cursor_++)->Copy();
+        if (!atc && (ret = jitter_->Correct(msg, ag)) != ERROR_SUCCESS)
+        {
+            rs_freep(msg);
+            return ret;
+        }
+        pmsgs[count++] = msg;
+    }
+
     return ret;
 }
 
+bool Consumer::ready()
+{
+    int nb_msgs = queue_->Size() + (int)(ring_->Head() - cursor_);
+    int duration_ms = rs_max(queue_->Duration(), ring_->Duration(cursor_));
+    return nb_msgs > mw_min_msgs_ && duration_ms > mw_duration_;
+}
+
+void Consumer::wait_ring()
+{
+    // the ring messages to reach the min msgs, and the duration from the cursor unless
+    // the queue already covers it
+    int64_t seq = cursor_ + mw_min_msgs_ + 1 - queue_->Size();
+    int duration = queue_->Duration() > mw_duration_ ? -1 : mw_duration_;
+    if (duration >= 0)
+    {
+        seq = rs_max(seq, cursor_ + 1);
+    }
+    ring_->AddWaiter(this, seq, cursor_, duration);
+}
+
+void Consumer::Notify()
+{
+    if (!mw_waiting_)
+    {
+        return;
+    }
+
+    if (!ready())
+    {
+        wait_ring();
+        return;
+    }
+
+    mw_waiting_ = false;
+    mw_scheduled_ = true;
+    _wakeup->Schedule(this);
+}
+
+void Consumer::OnWakeup()
+{
+    mw_scheduled_ = false;
+    if (mw_poller_)
+    {
+        st_thread_interrupt(mw_poller_);
+        return;
+    }
+    st_cond_signal(mw_wait_);
+}
+
 void Consumer::Wait(int nb_msgs, int duration)
 {
     if (pause_)
@@ -126,18 +356,57 @@ void Consumer::Wait(int nb_msgs, int duration)
     mw_min_msgs_ = nb_msgs;
     mw_duration_ = duration;
 
-    int duration_ms = queue_->Duration();
-    bool match_min_msgs = queue_->Size() > mw_min_msgs_;
-
-    if (match_min_msgs && duration_ms > mw_duration_)
+    if (ready())
     {
         return;
     }
 
     mw_waiting_ = true;
+    wait_ring();
     st_cond_wait(mw_wait_);
 }
 
+int Consumer::PollWait(st_netfd_t stfd, int nb_msgs, int duration)
+{
+    pollfd pfd;
+    pfd.fd = st_netfd_fileno(stfd);
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    mw_min_msgs_ = nb_msgs;
+    mw_duration_ = duration;
+
+    // the messages are ready, only peek the fd
+    if (!pause_ && ready())
+    {
+        return ::poll(&pfd, 1, 0) > 0 ? pfd.revents : 0;
+    }
+
+    if (!pause_)
+    {
+        mw_waiting_ = true;
+        wait_ring();
+    }
+
+    // no yield between set and clear, so the poller is only interrupted in the poll
+    mw_poller_ = st_thread_self();
+    int r = st_poll(&pfd, 1, ST_UTIME_NO_TIMEOUT);
+    mw_poller_ = nullptr;
+
+    if (mw_waiting_)
+    {
+        mw_waiting_ = false;
+        ring_->RemoveWaiter(this);
+    }
+    if (mw_scheduled_)
+    {
+        mw_scheduled_ = false;
+        _wakeup->Cancel(this);
+    }
+
+    return r > 0 ? pfd.revents : 0;
+}
+
 int Consumer::OnPlayClientPause(bool is_pause)
 {
     int ret = ERROR_SUCCESS;
@@ -149,6 +418,11 @@ int Consumer::OnPlayClientPause(bool is_pause)
 
 void Consumer::WakeUp()
 {
+    if (mw_poller_)
+    {
+        st_thread_interrupt(mw_poller_);
+        return;
+    }
 
     if (mw_waiting_)
     {
@@ -163,4 +437,9 @@ void Consumer::UpdateSourceId()
     should_update_source_id_ = true;
 }
 
+int64_t Consumer::GetDroppedFrames()
+{
+    return queue_->GetDroppedFrames() + nb_skipped_frames_;
+}
+
 }
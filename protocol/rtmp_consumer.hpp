@@ -4,11 +4,15 @@
 #include <common/core.hpp>
 #include <common/connection.hpp>
 #include <protocol/rtmp_jitter.hpp>
+#include <common/thread.hpp>
+
+#include <vector>
 
 namespace rtmp
 {
 
 class MessageQueue;
+class MessageRing;
 class Source;
 
 class IWakeable
@@ -21,6 +25,44 @@ public:
     virtual void WakeUp() = 0;
 };
 
+class Consumer;
+
+/**
+ * coalesce the wakeups of the consumers of a scheduler thread. the ready consumers are
+ * collected and waked up in one batch per tick, instead of a context switch for each
+ * consumer of each message. the tick should be far less than the mw sleep of players.
+ * 0 tick wakes up the consumer immediately.
+ */
+class WakeupScheduler : public internal::IThreadHandler
+{
+public:
+    WakeupScheduler();
+    virtual ~WakeupScheduler();
+
+public:
+    virtual int32_t Initialize(int tick_ms);
+    virtual void Schedule(Consumer *consumer);
+    virtual void Cancel(Consumer *consumer);
+    virtual double GetWakeupsPerSecond();
+    // internal::IThreadHandler
+    virtual int32_t Cycle() override;
+
+private:
+    void sample(int nb_wakeups);
+
+private:
+    int tick_ms_;
+    std::vector<Consumer *> ready_;
+    st_cond_t cond_;
+    bool waiting_;
+    internal::Thread *thread_;
+    int64_t nb_wakeups_;
+    int64_t nb_ticks_;
+    int64_t sample_time_;
+    int64_t sample_wakeups_;
+    double wakeups_per_second_;
+};
+
 class Consumer : public IWakeable
 {
 public:
@@ -33,22 +75,46 @@ public:
     virtual int Enqueue(SharedPtrMessage *shared_msg, bool atc, JitterAlgorithm ag);
     virtual int DumpPackets(MessageArray *msg_arr, int &count);
     virtual void Wait(int nb_msgs, int duration);
+    // wait for the consumer ready or the fd readable in the same coroutine,
+    // return the revents of the fd, 0 when woken by the consumer
+    virtual int PollWait(st_netfd_t stfd, int nb_msgs, int duration);
     virtual int OnPlayClientPause(bool is_pause);
     virtual void UpdateSourceId();
+    // the frames dropped by queue overflow and skipped by lagging behind the ring
+    virtual int64_t GetDroppedFrames();
+    // called by ring when the target of wait reached, wait again when not ready
+    virtual void Notify();
+    // called by the wakeup scheduler
+    virtual void OnWakeup();
     //IWakeable
     virtual void WakeUp() override;
+private:
+    bool ready();
+    // wait in ring for the target of ready
+    void wait_ring();
+    int dump_ring(SharedPtrMessage **pmsgs, int max, int &count);
 private:
     Source *source_;
     Connection *conn_;
     bool pause_;
     Jitter *jitter_;
+    // priming messages, the metadata, sequence headers and gop cache
     MessageQueue *queue_;
+    MessageRing *ring_;
+    int64_t cursor_;
+    int64_t nb_skipped_frames_;
     bool should_update_source_id_;
     st_cond_t mw_wait_;
     bool mw_waiting_;
+    bool mw_scheduled_;
+    // the coroutine blocked in PollWait, interrupted when ready
+    st_thread_t mw_poller_;
     int mw_min_msgs_;
     int mw_duration_;
 };
 
 }
+
+extern thread_local rtmp::WakeupScheduler *_wakeup;
+
 #endif
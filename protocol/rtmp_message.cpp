@@ -3,7 +3,12 @@
 #include <common/utils.hpp>
 #include <common/log.hpp>
 #include <common/error.hpp>
+#include <common/bytes.hpp>
 #include <muxer/flv.hpp>
+#include <protocol/rtmp_consumer.hpp>
+
+#include <algorithm>
+#include <functional>
 
 namespace rtmp
 {
@@ -168,7 +173,7 @@ bool MessageHeader::IsAggregate()
 {
     if (message_type == RTMP_MSG_AGGREGATE)
         return true;
-    return true;
+    return false;
 }
 
 void MessageHeader::InitializeAMF0Script(int32_t size, int32_t stream)
@@ -211,15 +216,14 @@ CommonMessage::CommonMessage() : size(0),
 
 CommonMessage::~CommonMessage()
 {
-    rs_freepa(payload);
-    payload = new char[size];
-    rs_verbose("create payload for rtmp message, size=%d", size);
+    BufferPool::Free(payload);
+    payload = nullptr;
 }
 
 void CommonMessage::CreatePlayload(int32_t size)
 {
-    rs_freepa(payload);
-    payload = new char[size];
+    BufferPool::Free(payload);
+    payload = BufferPool::Alloc(size);
     rs_verbose("create payload for rtmp message,size=%d", size);
 }
 
@@ -237,6 +241,25 @@ ChunkStream::~ChunkStream()
 
 }
 
+void *ChunkStream::operator new(size_t size)
+{
+    if (size != sizeof(ChunkStream))
+    {
+        return ::operator new(size);
+    }
+    return SlabPool<ChunkStream>::Alloc();
+}
+
+void ChunkStream::operator delete(void *p, size_t size)
+{
+    if (size != sizeof(ChunkStream))
+    {
+        ::operator delete(p);
+        return;
+    }
+    SlabPool<ChunkStream>::Free(p);
+}
+
 SharedPtrMessage::SharedPtrMessage() : ptr_(nullptr)
 {
 
@@ -246,27 +269,51 @@ SharedPtrMessage::~SharedPtrMessage()
 {
     if(ptr_)
     {
-        if (ptr_->shared_count == 0)
-        {
-            rs_freep(ptr_);
-        }
-        else
-        {
-            ptr_->shared_count--;
-        }
+        SharedPtrPayload::Release(ptr_);
     }
 }
 
 SharedPtrMessage::SharedPtrPayload::SharedPtrPayload() : payload(nullptr),
                                                         size(0),
-                                                        shared_count(0)
+                                                        shared_count(0),
+                                                        cross_thread(false),
+                                                        pooled(false),
+                                                        parent(nullptr)
 {
-
+    memset(wires, 0, sizeof(wires));
 }
 
 SharedPtrMessage::SharedPtrPayload::~SharedPtrPayload()
 {
-    rs_freep(payload);
+    for (int i = 0; i < RTMP_WIRE_CACHE_VARIANTS; i++)
+    {
+        if (wires[i].data)
+        {
+            WireCacheStat().bytes -= wires[i].size;
+            BufferPool::Free(wires[i].data);
+        }
+    }
+
+    if (parent)
+    {
+        Release(parent);
+        return;
+    }
+    if (pooled)
+    {
+        BufferPool::Free(payload);
+        return;
+    }
+    rs_freepa(payload);
+}
+
+void SharedPtrMessage::SharedPtrPayload::Release(SharedPtrPayload *p)
+{
+    // the copies may be released by other scheduler threads
+    if (p->shared_count.fetch_sub(1, std::memory_order_acq_rel) == 0)
+    {
+        rs_freep(p);
+    }
 }
 
 int SharedPtrMessage::Create(MessageHeader *pheader, char *payload, int size)
@@ -307,6 +354,7 @@ int SharedPtrMessage::Create(CommonMessage *msg)
     {
         return ret;
     }
+    ptr_->pooled = true;
     msg->payload = nullptr;
     msg->size = 0;
 
@@ -364,11 +412,152 @@ int SharedPtrMessage::ChunkHeader(char *buf, bool c0)
     }
 }
 
+SharedMesageHeader *SharedPtrMessage::GetHeader()
+{
+    return &ptr_->header;
+}
+
+int SharedPtrMessage::WireFormat(int chunk_size, char **pwire)
+{
+    // the extended timestamp is in every continuation header
+    if (ptr_->cross_thread || (uint32_t)timestamp >= RTMP_EXTENDED_TIMESTAMPE)
+    {
+        return 0;
+    }
+
+    WireStat &stat = WireCacheStat();
+    WireCache *wire = nullptr;
+    WireCache *free_wire = nullptr;
+    for (int i = 0; i < RTMP_WIRE_CACHE_VARIANTS; i++)
+    {
+        WireCache *w = &ptr_->wires[i];
+        if (w->chunk_size == chunk_size)
+        {
+            wire = w;
+            break;
+        }
+        if (!w->chunk_size && !free_wire)
+        {
+            free_wire = w;
+        }
+    }
+
+    // the single consumer sends the payload in place, never pays the copy
+    if (!wire)
+    {
+        if (free_wire)
+        {
+            free_wire->chunk_size = chunk_size;
+        }
+        return 0;
+    }
+    if (wire->data)
+    {
+        stat.nb_hits++;
+        *pwire = wire->data;
+        return wire->size;
+    }
+
+    // the fmt3 header of one byte before each chunk but the first
+    int nb_chunks = (size + chunk_size - 1) / chunk_size;
+    char *data = BufferPool::Alloc(size + nb_chunks - 1);
+
+    char *p = data;
+    char *payload_p = payload;
+    char *pend = payload + size;
+    while (payload_p < pend)
+    {
+        if (payload_p != payload)
+        {
+            p += ChunkHeader(p, false);
+        }
+        int payload_size = rs_min(chunk_size, (int)(pend - payload_p));
+        memcpy(p, payload_p, payload_size);
+        p += payload_size;
+        payload_p += payload_size;
+    }
+
+    wire->data = data;
+    wire->size = (int)(p - data);
+    wire->chunk_size = chunk_size;
+
+    stat.nb_builds++;
+    stat.bytes += wire->size;
+    stat.high_water = rs_max(stat.high_water, stat.bytes);
+
+    *pwire = wire->data;
+    return wire->size;
+}
+
+int64_t SharedPtrMessage::MemorySize()
+{
+    return (int64_t)size * 2 + (size + RTMP_CONSTS_RTMP_MIN_CHUNK_SIZE - 1) / RTMP_CONSTS_RTMP_MIN_CHUNK_SIZE;
+}
+
+void SharedPtrMessage::Share()
+{
+    ptr_->cross_thread = true;
+}
+
+void *SharedPtrMessage::operator new(size_t size)
+{
+    if (size != sizeof(SharedPtrMessage))
+    {
+        return ::operator new(size);
+    }
+    return SlabPool<SharedPtrMessage>::Alloc();
+}
+
+void SharedPtrMessage::operator delete(void *p, size_t size)
+{
+    if (size != sizeof(SharedPtrMessage))
+    {
+        ::operator delete(p);
+        return;
+    }
+    SlabPool<SharedPtrMessage>::Free(p);
+}
+
+void *SharedPtrMessage::SharedPtrPayload::operator new(size_t size)
+{
+    if (size != sizeof(SharedPtrPayload))
+    {
+        return ::operator new(size);
+    }
+    return SlabPool<SharedPtrPayload>::Alloc();
+}
+
+void SharedPtrMessage::SharedPtrPayload::operator delete(void *p, size_t size)
+{
+    if (size != sizeof(SharedPtrPayload))
+    {
+        ::operator delete(p);
+        return;
+    }
+    SlabPool<SharedPtrPayload>::Free(p);
+}
+
+PoolStat &SharedPtrMessage::MessagePoolStat()
+{
+    return SlabPool<SharedPtrMessage>::Stat();
+}
+
+PoolStat &SharedPtrMessage::PayloadPoolStat()
+{
+    return SlabPool<SharedPtrPayload>::Stat();
+}
+
+WireStat &SharedPtrMessage::WireCacheStat()
+{
+    static thread_local WireStat stat = {0, 0, 0, 0};
+    return stat;
+}
+
 SharedPtrMessage *SharedPtrMessage::Copy()
 {
     SharedPtrMessage *copy = new SharedPtrMessage;
     copy->ptr_ = ptr_;
-    ptr_->shared_count++;
+    ptr_->shared_count.fetch_add(1, std::memory_order_relaxed);
 
     copy->timestamp = timestamp;
     copy->stream_id = stream_id;
@@ -377,6 +566,81 @@ SharedPtrMessage *SharedPtrMessage::Copy()
     return copy;
 }
 
+SharedPtrMessage *SharedPtrMessage::CopyForShare()
+{
+    bool wired = false;
+    for (int i = 0; i < RTMP_WIRE_CACHE_VARIANTS; i++)
+    {
+        wired = wired || ptr_->wires[i].data;
+    }
+    if (!wired)
+    {
+        return Copy();
+    }
+
+    MessageHeader header;
+    header.message_type = ptr_->header.message_type;
+    header.perfer_cid = ptr_->header.perfer_cid;
+    header.timestamp = timestamp;
+    header.stream_id = stream_id;
+
+    char *data = BufferPool::Alloc(size);
+    memcpy(data, payload, size);
+
+    SharedPtrMessage *copy = new SharedPtrMessage;
+    copy->Create(&header, data, size);
+    copy->ptr_->pooled = true;
+    return copy;
+}
+
+SharedPtrMessage *SharedPtrMessage::Slice(MessageHeader *pheader, char *payload, int size)
+{
+    SharedPtrMessage *slice = new SharedPtrMessage;
+    slice->Create(pheader, payload, size);
+
+    slice->ptr_->parent = ptr_;
+    ptr_->shared_count.fetch_add(1, std::memory_order_relaxed);
+    return slice;
+}
+
+SharedPtrMessage *SharedPtrMessage::Aggregate(SharedPtrMessage **msgs, int nb_msgs, int stream_id)
+{
+    // the flv tag header and the previous tag size of each message
+    int size = 0;
+    for (int i = 0; i < nb_msgs; i++)
+    {
+        size += RTMP_AGGREGATE_TAG_HEADER_SIZE + msgs[i]->size + 4;
+    }
+
+    CommonMessage msg;
+    msg.CreatePlayload(size);
+    msg.size = size;
+    msg.header.message_type = RTMP_MSG_AGGREGATE;
+    msg.header.payload_length = size;
+    msg.header.timestamp = msgs[0]->timestamp;
+    msg.header.stream_id = stream_id;
+    msg.header.perfer_cid = RTMP_CID_OVER_STREAM;
+
+    // the size is exactly the tags, write unchecked
+    ByteWriter writer(msg.payload, size);
+    for (int i = 0; i < nb_msgs; i++)
+    {
+        SharedPtrMessage *m = msgs[i];
+        uint32_t timestamp = (uint32_t)m->timestamp;
+        writer.Write1(m->ptr_->header.message_type);
+        writer.Write3(m->size);
+        writer.Write3(timestamp & 0x00ffffff);
+        writer.Write1((timestamp >> 24) & 0xff);
+        writer.Write3(0);
+        writer.WriteBytes(m->payload, m->size);
+        writer.Write4(RTMP_AGGREGATE_TAG_HEADER_SIZE + m->size);
+    }
+
+    SharedPtrMessage *aggregate = new SharedPtrMessage;
+    aggregate->Create(&msg);
+    return aggregate;
+}
+
 MessageArray::MessageArray(int max_msgs)
 {
     // TODO
@@ -415,6 +679,8 @@ MessageQueue::MessageQueue()
     av_start_time_ = -1;
     av_end_time_ = -1;
     queue_size_ms_ = 0;
+    nb_dropped_frames_ = 0;
+    nb_shrinks_ = 0;
 }
 
 MessageQueue::~MessageQueue()
@@ -437,13 +703,48 @@ void MessageQueue::SetQueueSize(double second)
     queue_size_ms_ = (int)(second * 1000);
 }
 
+int64_t MessageQueue::GetDroppedFrames()
+{
+    return nb_dropped_frames_;
+}
+
+int64_t MessageQueue::GetShrinks()
+{
+    return nb_shrinks_;
+}
+
 void MessageQueue::Shrink()
 {
     SharedPtrMessage *video_sh = nullptr;
     SharedPtrMessage *audio_sh = nullptr;
 
+    // the newest keyframe which has av frames to drop before it
+    int keyframe = -1;
+    bool has_frames = false;
     int msgs_size = msgs_.Size();
-    for (int i=0;i<msgs_size;i++)
+    for (int i = 0; i < msgs_size; i++)
+    {
+        SharedPtrMessage *msg = msgs_.At(i);
+        if (msg->IsVideo() && FlvDemuxer::IsVideoSeqenceHeader(msg->payload, msg->size))
+        {
+            continue;
+        }
+        if (msg->IsVideo() && FlvDemuxer::IsKeyFrame(msg->payload, msg->size) && has_frames)
+        {
+            keyframe = i;
+        }
+        if (msg->IsAV())
+        {
+            has_frames = true;
+        }
+    }
+
+    // no keyframe to start from, drop all av frames
+    int end = keyframe == -1 ? msgs_size : keyframe;
+
+    // keep the metadata and the latest sequence headers before the keyframe
+    std::vector<SharedPtrMessage *> kept;
+    for (int i = 0; i < end; i++)
     {
         SharedPtrMessage *msg = msgs_.At(i);
         if (msg->IsAudio() && FlvDemuxer::IsAudioSeqenceHeader(msg->payload, msg->size))
@@ -452,27 +753,49 @@ void MessageQueue::Shrink()
             audio_sh = msg;
             continue;
         }
-        if (msg->IsAudio() && FlvDemuxer::IsVideoSeqenceHeader(msg->payload, msg->size))
+        if (msg->IsVideo() && FlvDemuxer::IsVideoSeqenceHeader(msg->payload, msg->size))
         {
             rs_freep(video_sh);
             video_sh = msg;
             continue;
         }
+        if (!msg->IsAV())
+        {
+            kept.push_back(msg);
+            continue;
+        }
+        nb_dropped_frames_++;
         rs_freep(msg);
     }
+
+    std::vector<SharedPtrMessage *> left;
+    for (int i = end; i < msgs_size; i++)
+    {
+        left.push_back(msgs_.At(i));
+    }
     msgs_.Clear();
 
-    av_start_time_ = av_end_time_;
-    if(audio_sh)
+    av_start_time_ = keyframe == -1 ? av_end_time_ : left[0]->timestamp;
+    for (size_t i = 0; i < kept.size(); i++)
+    {
+        msgs_.PushBack(kept[i]);
+    }
+    if (audio_sh)
     {
-        audio_sh->timestamp = av_end_time_;
+        audio_sh->timestamp = av_start_time_;
         msgs_.PushBack(audio_sh);
     }
-    if(video_sh)
+    if (video_sh)
     {
-        video_sh->timestamp = av_end_time_;
+        video_sh->timestamp = av_start_time_;
         msgs_.PushBack(video_sh);
     }
+    for (size_t i = 0; i < left.size(); i++)
+    {
+        msgs_.PushBack(left[i]);
+    }
+
+    nb_shrinks_++;
 }
 
 int MessageQueue::Enqueue(SharedPtrMessage *msg, bool *is_overflow)
@@ -481,9 +804,9 @@ int MessageQueue::Enqueue(SharedPtrMessage *msg, bool *is_overflow)
 
     if (msg->IsAV())
     {
-        if (av_end_time_ == -1)
+        if (av_start_time_ == -1)
         {
-            av_end_time_ = msg->timestamp;
+            av_start_time_ = msg->timestamp;
         }
         av_end_time_ = msg->timestamp;
     }
@@ -510,29 +833,22 @@ int MessageQueue::DumpPackets(int max_count, SharedPtrMessage **pmsgs, int &coun
 {
     int ret = ERROR_SUCCESS;
 
-    int nb_msgs = msgs_.Size();
-    if (nb_msgs <= 0)
+    if (msgs_.Empty())
     {
         return ret;
     }
-    count = rs_min(nb_msgs, max_count);
 
-    SharedPtrMessage **omsgs = msgs_.Data();
-    for(int i=0;i<count;i++)
-    {
-        pmsgs[i] = omsgs[i];
-    }
+    count = msgs_.PopFront(pmsgs, max_count);
 
-    SharedPtrMessage *last = omsgs[count-1];
-    av_start_time_ = last->timestamp;
-    if (count>nb_msgs)
-    {
-        msgs_.Clear();
-    }
-    else
+    for (int i = count - 1; i >= 0; i--)
     {
-        msgs_.Erase(msgs_.Begin(), msgs_.Begin() + count);
+        if (pmsgs[i]->IsAV())
+        {
+            av_start_time_ = pmsgs[i]->timestamp;
+            break;
+        }
     }
+
     return ret;
 }
 
@@ -542,4 +858,185 @@ int MessageQueue::DumpPackets(Consumer *consumer, bool atc ,JitterAlgorithm ag)
     return ret;
 }
 
+MessageRing::MessageRing(int capacity)
+{
+    rs_assert(capacity > 0 && (capacity & (capacity - 1)) == 0);
+    capacity_ = capacity;
+    mask_ = capacity - 1;
+    msgs_ = new SharedPtrMessage *[capacity_];
+    for (int i = 0; i < capacity_; i++)
+    {
+        msgs_[i] = nullptr;
+    }
+    head_ = tail_ = 0;
+    keyframe_ = -1;
+    window_ms_ = 0;
+    next_waiter_id_ = 0;
+}
+
+MessageRing::~MessageRing()
+{
+    while (tail_ < head_)
+    {
+        release_tail();
+    }
+    rs_freepa(msgs_);
+}
+
+void MessageRing::SetWindow(double second)
+{
+    window_ms_ = (int64_t)(second * 1000);
 }
+
+int64_t MessageRing::Head()
+{
+    return head_;
+}
+
+int64_t MessageRing::Tail()
+{
+    return tail_;
+}
+
+int64_t MessageRing::KeyFrame()
+{
+    return keyframe_;
+}
+
+SharedPtrMessage *MessageRing::At(int64_t seq)
+{
+    rs_assert(seq >= tail_ && seq < head_);
+    return msgs_[seq & mask_];
+}
+
+int MessageRing::Duration(int64_t seq)
+{
+    seq = rs_max(seq, tail_);
+    if (seq >= head_)
+    {
+        return 0;
+    }
+    return (int)(msgs_[(head_ - 1) & mask_]->timestamp - msgs_[seq & mask_]->timestamp);
+}
+
+void MessageRing::release_tail()
+{
+    SharedPtrMessage *&msg = msgs_[tail_ & mask_];
+    rs_freep(msg);
+    msg = nullptr;
+    tail_++;
+}
+
+void MessageRing::Push(SharedPtrMessage *msg, bool is_keyframe)
+{
+    if (head_ - tail_ >= capacity_)
+    {
+        release_tail();
+    }
+
+    msgs_[head_ & mask_] = msg;
+    if (is_keyframe)
+    {
+        keyframe_ = head_;
+    }
+    head_++;
+
+    // keep the window, but never release the latest message
+    while (window_ms_ > 0 && tail_ < head_ - 1 && msg->timestamp - msgs_[tail_ & mask_]->timestamp > window_ms_)
+    {
+        release_tail();
+    }
+
+    std::greater<Waiter> cmp;
+    while (!seq_waiters_.empty() && seq_waiters_.front().target <= head_)
+    {
+        std::pop_heap(seq_waiters_.begin(), seq_waiters_.end(), cmp);
+        Waiter w = seq_waiters_.back();
+        seq_waiters_.pop_back();
+        if (!is_alive(w))
+        {
+            continue;
+        }
+        if (w.duration_ms < 0)
+        {
+            notify(w);
+            continue;
+        }
+
+        // the message at cursor is in ring now, wait for the timestamp
+        w.target = msgs_[rs_max(w.cursor, tail_) & mask_]->timestamp + w.duration_ms;
+        ts_waiters_.push_back(w);
+        std::push_heap(ts_waiters_.begin(), ts_waiters_.end(), cmp);
+    }
+
+    while (!ts_waiters_.empty() && ts_waiters_.front().target < msg->timestamp)
+    {
+        std::pop_heap(ts_waiters_.begin(), ts_waiters_.end(), cmp);
+        Waiter w = ts_waiters_.back();
+        ts_waiters_.pop_back();
+        if (is_alive(w))
+        {
+            notify(w);
+        }
+    }
+}
+
+bool MessageRing::is_alive(const Waiter &w)
+{
+    std::unordered_map<Consumer *, uint64_t>::iterator it = waiting_.find(w.consumer);
+    return it != waiting_.end() && it->second == w.id;
+}
+
+void MessageRing::notify(const Waiter &w)
+{
+    // the consumer not ready waits again with the new target
+    waiting_.erase(w.consumer);
+    w.consumer->Notify();
+}
+
+void MessageRing::compact()
+{
+    std::greater<Waiter> cmp;
+    std::vector<Waiter> *heaps[] = {&seq_waiters_, &ts_waiters_};
+    for (int i = 0; i < 2; i++)
+    {
+        std::vector<Waiter> &heap = *heaps[i];
+        std::vector<Waiter> alive;
+        for (size_t j = 0; j < heap.size(); j++)
+        {
+            if (is_alive(heap[j]))
+            {
+                alive.push_back(heap[j]);
+            }
+        }
+        heap.swap(alive);
+        std::make_heap(heap.begin(), heap.end(), cmp);
+    }
+}
+
+void MessageRing::AddWaiter(Consumer *consumer, int64_t seq, int64_t cursor, int duration_ms)
+{
+    Waiter w;
+    w.target = seq;
+    w.id = ++next_waiter_id_;
+    w.consumer = consumer;
+    w.cursor = cursor;
+    w.duration_ms = duration_ms;
+    waiting_[consumer] = w.id;
+
+    seq_waiters_.push_back(w);
+    std::push_heap(seq_waiters_.begin(), seq_waiters_.end(), std::greater<Waiter>());
+
+    // the waits removed before their target are left in heaps, when the stream stalls
+    if (seq_waiters_.size() + ts_waiters_.size() > 2 * waiting_.size() + RTMP_MR_MSGS)
+    {
+        compact();
+    }
+}
+
+void MessageRing::RemoveWaiter(Consumer *consumer)
+{
+    waiting_.erase(consumer);
+}
+
+} // namespace rtmp
@@ -3,8 +3,14 @@
 
 #include <common/core.hpp>
 #include <common/queue.hpp>
+#include <common/pool.hpp>
+#include <protocol/rtmp_consts.hpp>
 #include <protocol/rtmp_jitter.hpp>
 
+#include <atomic>
+#include <unordered_map>
+#include <vector>
+
 namespace rtmp
 {
 class Consumer;
@@ -53,6 +59,7 @@ public:
     CommonMessage();
     virtual ~CommonMessage();
 public:
+    // the payload is allocated from BufferPool
     virtual void CreatePlayload(int32_t size);
 public:
     int32_t size;
@@ -65,6 +72,10 @@ class ChunkStream
 public:
     ChunkStream(int cid);
     virtual ~ChunkStream();
+
+    // allocated from the per thread slab pool
+    static void *operator new(size_t size);
+    static void operator delete(void *p, size_t size);
 public:
     int cid;
     char fmt;
@@ -81,6 +92,25 @@ struct SharedMesageHeader
     int perfer_cid;
 };
 
+// the chunks of message without the first header, for the chunk size. the first
+// header is per consumer, the continuation headers only depend on the cid.
+// the slot of chunk size without data is asked by one consumer only
+struct WireCache
+{
+    char *data;
+    int size;
+    int chunk_size;
+};
+
+// the wire caches of this thread
+struct WireStat
+{
+    int64_t nb_builds;
+    int64_t nb_hits;
+    int64_t bytes;
+    int64_t high_water;
+};
+
 class SharedPtrMessage
 {
 public:
@@ -96,7 +126,31 @@ public:
     virtual bool IsAudio();
     virtual bool IsVideo();
     virtual int ChunkHeader(char *buf, bool c0);
+    virtual SharedMesageHeader *GetHeader();
+    // the chunked wire format shared by all copies without the first header, serialized
+    // when the second consumer asks for the chunk size. return 0 for the first consumer,
+    // when all variants are taken by other chunk size, or the timestamp is extended
+    virtual int WireFormat(int chunk_size, char **pwire);
+    // the bytes of payload and the wire of the smallest chunk size at most, which is
+    // built only when the message is sent to more than one consumer
+    virtual int64_t MemorySize();
+    // the payload is read by other scheduler threads, the wire cache is frozen then
+    virtual void Share();
     virtual SharedPtrMessage *Copy();
+    // the copy for other scheduler threads, with its own payload when the wires are
+    // cached, which are freed by the thread built them
+    virtual SharedPtrMessage *CopyForShare();
+    // the message of the sub slice of payload, which shares the payload buffer
+    virtual SharedPtrMessage *Slice(MessageHeader *pheader, char *payload, int size);
+    // pack the av messages to one aggregate message, the payloads are copied as flv tags
+    static SharedPtrMessage *Aggregate(SharedPtrMessage **msgs, int nb_msgs, int stream_id);
+
+    // allocated from the per thread slab pool
+    static void *operator new(size_t size);
+    static void operator delete(void *p, size_t size);
+    static PoolStat &MessagePoolStat();
+    static PoolStat &PayloadPoolStat();
+    static WireStat &WireCacheStat();
 
 private:
     class SharedPtrPayload
@@ -104,11 +158,20 @@ private:
     public:
         SharedPtrPayload();
         virtual ~SharedPtrPayload();
+        static void *operator new(size_t size);
+        static void operator delete(void *p, size_t size);
+        static void Release(SharedPtrPayload *p);
     public:
         SharedMesageHeader header;
         char *payload;
         int size;
-        int shared_count;
+        std::atomic<int> shared_count;
+        bool cross_thread;
+        // payload is from BufferPool, otherwise allocated by new[]
+        bool pooled;
+        // the payload is the slice of parent, which is released instead
+        SharedPtrPayload *parent;
+        WireCache wires[RTMP_WIRE_CACHE_VARIANTS];
     };
 public:
     int64_t timestamp;
@@ -148,8 +211,12 @@ public:
     virtual int Enqueue(SharedPtrMessage *msg, bool *is_overflow = nullptr);
     virtual int DumpPackets(int max_count, SharedPtrMessage **pmsgs, int &count);
     virtual int DumpPackets(Consumer *consumer, bool atc, rtmp::JitterAlgorithm ag);
+    // the av frames dropped by overflow
+    virtual int64_t GetDroppedFrames();
+    virtual int64_t GetShrinks();
 
 protected:
+    // drop from head to the newest keyframe, keep the metadata and sequence headers
     virtual void Shrink();
     virtual void Clear();
 
@@ -157,7 +224,80 @@ private:
     int64_t av_start_time_;
     int64_t av_end_time_;
     int64_t queue_size_ms_;
-    FastVector<SharedPtrMessage *> msgs_;
+    int64_t nb_dropped_frames_;
+    int64_t nb_shrinks_;
+    RingQueue<SharedPtrMessage *> msgs_;
+};
+
+/**
+ * the fan-out ring of a source, shared by all consumers of the source.
+ * the source pushes one copy of each av message, every consumer reads the ring by
+ * its own cursor(the sequence number), so the fan-out is O(1) per message.
+ * the messages older than the window are released, a consumer whose cursor falls
+ * behind the tail is lagging, which should skip to the latest keyframe.
+ * the waiters are kept in heaps by their ready target, the sequence then the timestamp,
+ * so a push only touches the waiters which become ready.
+ */
+class MessageRing
+{
+public:
+    MessageRing(int capacity);
+    virtual ~MessageRing();
+
+public:
+    virtual void SetWindow(double second);
+    // sequence of the next message to push
+    virtual int64_t Head();
+    // sequence of the oldest message in ring
+    virtual int64_t Tail();
+    // sequence of the latest keyframe, less than tail when no keyframe in ring
+    virtual int64_t KeyFrame();
+    virtual SharedPtrMessage *At(int64_t seq);
+    virtual int Duration(int64_t seq);
+    // the ring takes the ownership of msg
+    virtual void Push(SharedPtrMessage *msg, bool is_keyframe);
+    // wait until the head passes seq, then until the latest timestamp is later than the
+    // message at cursor by duration_ms, the duration is ignored when negative
+    virtual void AddWaiter(Consumer *consumer, int64_t seq, int64_t cursor, int duration_ms);
+    virtual void RemoveWaiter(Consumer *consumer);
+
+private:
+    struct Waiter
+    {
+        // the head or the timestamp to reach
+        int64_t target;
+        uint64_t id;
+        Consumer *consumer;
+        int64_t cursor;
+        int duration_ms;
+
+        bool operator>(const Waiter &o) const
+        {
+            return target > o.target;
+        }
+    };
+
+private:
+    void release_tail();
+    // the removed or waited again waiters are skipped when popped
+    bool is_alive(const Waiter &w);
+    void notify(const Waiter &w);
+    void compact();
+
+private:
+    SharedPtrMessage **msgs_;
+    int capacity_;
+    int mask_;
+    int64_t head_;
+    int64_t tail_;
+    int64_t keyframe_;
+    int64_t window_ms_;
+    // the min heaps of the waiters by the head, then by the timestamp
+    std::vector<Waiter> seq_waiters_;
+    std::vector<Waiter> ts_waiters_;
+    // the id of the live wait of each consumer
+    std::unordered_map<Consumer *, uint64_t> waiting_;
+    uint64_t next_waiter_id_;
 };
 
 }
@@ -1,6 +1,8 @@
 #include <protocol/rtmp_source.hpp>
 #include <protocol/rtmp_consts.hpp>
 #include <protocol/gop_cache.hpp>
+#include <protocol/time_shift.hpp>
+#include <protocol/rtmp_bridge.hpp>
 #include <muxer/flv.hpp>
 #include <common/config.hpp>
 
@@ -8,6 +10,7 @@
 #include <app/dvr.hpp>
 
 #include <sstream>
+#include <algorithm>
 
 
 
@@ -23,8 +26,123 @@ ISourceHandler::~ISourceHandler()
 {
 }
 
+SourceDispatcher::SourceDispatcher(Source *source) : source_(source),
+                                                     waiting_(false),
+                                                     error_(ERROR_SUCCESS),
+                                                     thread_(nullptr)
+{
+    cond_ = st_cond_new();
+    memset(&stat_, 0, sizeof(DispatchStat));
+}
+
+SourceDispatcher::~SourceDispatcher()
+{
+    if (thread_)
+    {
+        thread_->Stop();
+    }
+    rs_freep(thread_);
+
+    for (size_t i = 0; i < queue_.size(); i++)
+    {
+        rs_freep(queue_[i].msg);
+    }
+    queue_.clear();
+    st_cond_destroy(cond_);
+}
 
-std::map<std::string, Source *> Source::pool_;
+int32_t SourceDispatcher::Start()
+{
+    if (thread_)
+    {
+        return ERROR_SUCCESS;
+    }
+    thread_ = new internal::Thread("dispatch", this, 0, false);
+    return thread_->Start();
+}
+
+int SourceDispatcher::Enqueue(SharedPtrMessage *msg)
+{
+    // the dispatch failure is reported to the publisher by the next message
+    int ret = error_;
+    error_ = ERROR_SUCCESS;
+
+    DispatchItem item;
+    item.msg = msg;
+    item.ingest_us = Utils::GetSteadyMicroSeconds();
+    queue_.push_back(item);
+
+    // no thread before the first publish, dispatch in the caller coroutine
+    if (!thread_)
+    {
+        dispatch();
+        return ret;
+    }
+
+    if (waiting_)
+    {
+        waiting_ = false;
+        st_cond_signal(cond_);
+    }
+
+    return ret;
+}
+
+void SourceDispatcher::Flush()
+{
+    dispatch();
+}
+
+DispatchStat &SourceDispatcher::Stat()
+{
+    return stat_;
+}
+
+int32_t SourceDispatcher::Cycle()
+{
+    if (queue_.empty())
+    {
+        waiting_ = true;
+        st_cond_wait(cond_);
+        waiting_ = false;
+    }
+
+    dispatch();
+    return ERROR_SUCCESS;
+}
+
+void SourceDispatcher::dispatch()
+{
+    if (queue_.empty())
+    {
+        return;
+    }
+
+    int64_t now = Utils::GetSteadyMicroSeconds();
+    stat_.nb_batches++;
+
+    // never yields while dispatching, the ingest appends after the batch
+    while (!queue_.empty())
+    {
+        DispatchItem item = queue_.front();
+        queue_.pop_front();
+
+        int64_t latency = now - item.ingest_us;
+        stat_.nb_msgs++;
+        stat_.latency_sum_us += latency;
+        stat_.latency_max_us = rs_max(stat_.latency_max_us, latency);
+
+        int ret = source_->Dispatch(item.msg);
+        if (ret != ERROR_SUCCESS && error_ == ERROR_SUCCESS)
+        {
+            error_ = ret;
+        }
+        rs_freep(item.msg);
+    }
+}
+
+
+thread_local std::map<std::string, Source *> Source::pool_;
 
 Source::Source() : request_(nullptr)
 {
@@ -41,11 +159,18 @@ Source::Source() : request_(nullptr)
     mix_queue_ = new MixQueue<SharedPtrMessage>;
     dvr_ = new Dvr;
     gop_cache_ = new GopCache;
+    time_shift_ = new TimeShift;
+    ring_ = new MessageRing(RTMP_SOURCE_RING_SIZE);
     ag_ = JitterAlgorithm::FULL;
+    hub_stream_ = nullptr;
+    hub_version_ = 0;
+    bridge_ = nullptr;
+    dispatcher_ = new SourceDispatcher(this);
 }
 
 Source::~Source()
 {
+    rs_freep(dispatcher_);
     rs_freep(dvr_);
     rs_freep(mix_queue_);
     rs_freep(cache_sh_audio_);
@@ -53,6 +178,8 @@ Source::~Source()
     rs_freep(cache_metadata_);
     rs_freep(request_);
     rs_freep(gop_cache_);
+    rs_freep(time_shift_);
+    rs_freep(ring_);
 }
 
 int Source::FetchOrCreate(Request *r, ISourceHandler *h, Source **pps)
@@ -107,6 +234,8 @@ int Source::Initialize(Request *r, ISourceHandler *h)
     handler_ = h;
     request_ = r->Copy();
     atc_ = _config->GetATC(r->vhost);
+    ring_->SetWindow(_config->GetQueueSize(r->vhost));
+    time_shift_->SetWindow(_config->GetTimeShift(r->vhost));
     if ((ret = dvr_->Initialize(this, request_)) != ERROR_SUCCESS)
     {
         rs_error("dvr init failed.%d", ret);
@@ -123,7 +252,12 @@ bool Source::CanPublish(bool is_edge)
 
 void Source::OnConsumerDestory(Consumer *consumer)
 {
-
+    std::vector<Consumer *>::iterator it = std::find(consumers_.begin(), consumers_.end(), consumer);
+    if (it != consumers_.end())
+    {
+        consumers_.erase(it);
+    }
+    ring_->RemoveWaiter(consumer);
 }
 
 int Source::on_video_impl(SharedPtrMessage *msg)
@@ -164,15 +298,9 @@ int Source::on_video_impl(SharedPtrMessage *msg)
     }
     if (!drop_for_reduce)
     {
-        for (int i = 0;i<(int)consumers_.size(); i++)
-        {
-            Consumer *consumer = consumers_.at(i);
-            if (( ret = consumer->Enqueue(msg, atc_, ag_)) != ERROR_SUCCESS)
-            {
-                rs_error("dispatch video failed. ret=%d", ret);
-                return ret;
-            }
-        }
+        bool is_keyframe = !is_sequence_header && FlvDemuxer::IsKeyFrame(msg->payload, msg->size);
+        ring_->Push(msg->Copy(), is_keyframe);
+        relay_remote(msg, !is_sequence_header && !is_keyframe, is_keyframe);
     }
 
     if (is_sequence_header) {
@@ -180,6 +308,7 @@ int Source::on_video_impl(SharedPtrMessage *msg)
     }
 
     gop_cache_->Cache(msg);
+    time_shift_->Cache(msg, FlvDemuxer::IsKeyFrame(msg->payload, msg->size), cache_metadata_, cache_sh_video_, cache_sh_audio_);
 
     if (atc_) {
         if (cache_sh_audio_) {
@@ -244,15 +373,8 @@ int Source::on_audio_impl(SharedPtrMessage *msg)
 
     if (!drop_for_reduce)
     {
-        for (int i = 0; i < (int)consumers_.size(); i++)
-        {
-            Consumer *consumer = consumers_.at(i);
-            if ((ret = consumer->Enqueue(msg, atc_, ag_)) != ERROR_SUCCESS)
-            {
-                rs_error("dispatch audio failed, ret=%d", ret);
-                return ret;
-            }
-        }
+        ring_->Push(msg->Copy(), false);
+        relay_remote(msg, !is_sequence_header, false);
     }
 
     if (is_sequence_header || !cache_sh_audio_) {
@@ -265,6 +387,7 @@ int Source::on_audio_impl(SharedPtrMessage *msg)
     }
 
     gop_cache_->Cache(msg);
+    time_shift_->Cache(msg, false, cache_metadata_, cache_sh_video_, cache_sh_audio_);
 
     if (atc_) {
         if (cache_sh_audio_) {
@@ -293,38 +416,15 @@ int Source::OnAudio(CommonMessage *msg)
     }
 
     last_packet_time_ = msg->header.timestamp;
-    SharedPtrMessage shared_msg;
-    if ((ret = shared_msg.Create(msg)) != ERROR_SUCCESS)
+    SharedPtrMessage *shared_msg = new SharedPtrMessage;
+    if ((ret = shared_msg->Create(msg)) != ERROR_SUCCESS)
     {
         rs_error("initialize the audio failed, ret=%d", ret);
+        rs_freep(shared_msg);
         return ret;
     }
 
-    if (!mix_correct_)
-    {
-        return on_audio_impl(&shared_msg);
-    }
-
-    mix_queue_->Push(shared_msg.Copy());
-
-    SharedPtrMessage *m = mix_queue_->Pop();
-    if(!m)
-    {
-        return ret;
-    }
-
-    if (m->IsAudio())
-    {
-        on_audio_impl(m);
-    }
-    else
-    {
-        on_video_impl(m);
-    }
-
-    rs_freep(m);
-
-    return ret;
+    return dispatcher_->Enqueue(shared_msg);
 }
 
 int Source::OnMetadata(CommonMessage *msg, rtmp::OnMetadataPacket *pkt)
@@ -391,14 +491,26 @@ int Source::OnMetadata(CommonMessage *msg, rtmp::OnMetadataPacket *pkt)
     //     rs_warn("drop for reduce sh metadata, size=%d", msg->size);
     // }
 
-    rs_freep(cache_metadata_);
-    cache_metadata_ = new rtmp::SharedPtrMessage;
-    if ((ret = cache_metadata_->Create(&msg->header, payload, size)) != ERROR_SUCCESS)
+    SharedPtrMessage *shared_msg = new SharedPtrMessage;
+    if ((ret = shared_msg->Create(&msg->header, payload, size)) != ERROR_SUCCESS)
     {
         rs_error("initialize the cache metadata failed. ret=%d", ret);
+        rs_freep(shared_msg);
         return ret;
     }
 
+    return dispatcher_->Enqueue(shared_msg);
+}
+
+int Source::on_metadata_impl(SharedPtrMessage *msg)
+{
+    int ret = ERROR_SUCCESS;
+
+    rs_freep(cache_metadata_);
+    cache_metadata_ = msg->Copy();
+
+    relay_remote(cache_metadata_, false, false);
+
     if ((ret = dvr_->OnMetadata(cache_metadata_)) != ERROR_SUCCESS)
     {
         rs_error("dvr process on_meatadata message failed.ret=%d", ret);
@@ -408,6 +520,136 @@ int Source::OnMetadata(CommonMessage *msg, rtmp::OnMetadataPacket *pkt)
     return ret;
 }
 
+int Source::Dispatch(SharedPtrMessage *msg)
+{
+    int ret = ERROR_SUCCESS;
+
+    if (!msg->IsAV())
+    {
+        return on_metadata_impl(msg);
+    }
+
+    if (!mix_correct_)
+    {
+        return msg->IsAudio() ? on_audio_impl(msg) : on_video_impl(msg);
+    }
+
+    mix_queue_->Push(msg->Copy());
+
+    SharedPtrMessage *m = mix_queue_->Pop();
+    if (!m)
+    {
+        return ret;
+    }
+
+    if (m->IsAudio())
+    {
+        ret = on_audio_impl(m);
+    }
+    else
+    {
+        ret = on_video_impl(m);
+    }
+
+    rs_freep(m);
+
+    return ret;
+}
+
+int Source::OnRelay(SharedPtrMessage *msg)
+{
+    if (msg->IsAudio())
+    {
+        return on_audio_impl(msg);
+    }
+
+    if (msg->IsVideo())
+    {
+        return on_video_impl(msg);
+    }
+
+    rs_freep(cache_metadata_);
+    cache_metadata_ = msg->Copy();
+    return ERROR_SUCCESS;
+}
+
+void Source::relay_remote(SharedPtrMessage *msg, bool droppable, bool is_keyframe)
+{
+    if (!hub_stream_)
+    {
+        return;
+    }
+
+    std::vector<SourceBridge *> bridges;
+    if (_hub->Update(hub_stream_, hub_version_, bridges))
+    {
+        for (size_t i = 0; i < bridges.size(); i++)
+        {
+            SourceBridge *bridge = bridges[i];
+            if (!bridge->IsLocal() && std::find(bridges_.begin(), bridges_.end(), bridge) == bridges_.end())
+            {
+                prime_bridge(bridge);
+            }
+        }
+        bridges_.swap(bridges);
+    }
+
+    for (size_t i = 0; i < bridges_.size(); i++)
+    {
+        SourceBridge *bridge = bridges_[i];
+        if (!bridge->IsLocal())
+        {
+            bridge->Push(msg->CopyForShare(), droppable, is_keyframe);
+        }
+    }
+}
+
+void Source::prime_bridge(SourceBridge *bridge)
+{
+    if (cache_metadata_)
+    {
+        bridge->Push(cache_metadata_->CopyForShare(), false, false);
+    }
+    if (cache_sh_audio_)
+    {
+        bridge->Push(cache_sh_audio_->CopyForShare(), false, false);
+    }
+    if (cache_sh_video_)
+    {
+        bridge->Push(cache_sh_video_->CopyForShare(), false, false);
+    }
+
+    // the gop starts with the keyframe, which ends the dropping of bridge. the cached
+    // messages may be sent by local players, never share their wires
+    std::vector<SharedPtrMessage *> gop;
+    gop_cache_->Snapshot(gop);
+    for (size_t i = 0; i < gop.size(); i++)
+    {
+        SharedPtrMessage *msg = gop[i];
+        bool is_keyframe = msg->IsVideo() && FlvDemuxer::IsKeyFrame(msg->payload, msg->size);
+        bridge->Push(msg->CopyForShare(), !is_keyframe, is_keyframe);
+    }
+}
+
+int Source::subscribe()
+{
+    int ret = ERROR_SUCCESS;
+
+    SourceBridge *bridge = new SourceBridge(this);
+    if ((ret = bridge->Initialize()) != ERROR_SUCCESS)
+    {
+        rs_error("initialize source bridge failed. ret=%d", ret);
+        rs_freep(bridge);
+        return ret;
+    }
+
+    bridge_ = bridge;
+    _hub->Subscribe(request_->GetStreamUrl(), bridge_);
+
+    rs_trace("subscribe %s from the publisher thread", request_->GetStreamUrl().c_str());
+    return ret;
+}
+
 int Source::OnVideo(CommonMessage *msg)
 {
     int ret = ERROR_SUCCESS;
@@ -421,35 +663,98 @@ int Source::OnVideo(CommonMessage *msg)
     }
     last_packet_time_ = msg->header.timestamp;
 
-    SharedPtrMessage shared_msg;
-    if ((shared_msg.Create(msg)) != ERROR_SUCCESS)
+    SharedPtrMessage *shared_msg = new SharedPtrMessage;
+    if ((ret = shared_msg->Create(msg)) != ERROR_SUCCESS)
     {
         rs_error("initialize the video failed.ret=%d", ret);
+        rs_freep(shared_msg);
         return ret;
     }
 
-    if (!mix_correct_)
-    {
-        return on_video_impl(&shared_msg);
-    }
+    return dispatcher_->Enqueue(shared_msg);
+}
 
-    mix_queue_->Push(shared_msg.Copy());
+int Source::OnAggregate(CommonMessage *msg)
+{
+    int ret = ERROR_SUCCESS;
 
-    SharedPtrMessage *m = mix_queue_->Pop();
-    if (!m)
+    SharedPtrMessage *aggregate = new SharedPtrMessage;
+    if ((ret = aggregate->Create(msg)) != ERROR_SUCCESS)
     {
+        rs_error("initialize the aggregate failed. ret=%d", ret);
+        rs_freep(aggregate);
         return ret;
     }
+    rs_auto_free(SharedPtrMessage, aggregate);
 
-    if (m->IsAudio())
+    ByteReader reader(aggregate->payload, aggregate->size);
+
+    // the timestamp of the first tag is the timestamp of the aggregate
+    bool first = true;
+    int64_t delta = 0;
+    while (reader.Left() > 0)
     {
-        on_audio_impl(m);
-    }
-    else{
-        on_video_impl(m);
-    }
+        if (!reader.Require(RTMP_AGGREGATE_TAG_HEADER_SIZE))
+        {
+            ret = ERROR_RTMP_AGGREGATE;
+            rs_error("invalid aggregate tag header. ret=%d", ret);
+            return ret;
+        }
 
-    rs_freep(m);
+        int8_t type = reader.Read1();
+        int32_t data_size = reader.Read3();
+        uint32_t timestamp = reader.Read3();
+        timestamp |= (uint32_t)reader.Read1() << 24;
+        reader.Skip(3);
+
+        if (!reader.Require(data_size + 4))
+        {
+            ret = ERROR_RTMP_AGGREGATE;
+            rs_error("invalid aggregate tag, size=%d, left=%d. ret=%d", data_size, reader.Left(), ret);
+            return ret;
+        }
+
+        if (first)
+        {
+            delta = msg->header.timestamp - timestamp;
+            first = false;
+        }
+
+        MessageHeader header;
+        if (type == RTMP_MSG_AUDIO_MESSAGE)
+        {
+            header.InitializeAudio(data_size, 0, msg->header.stream_id);
+        }
+        else if (type == RTMP_MSG_VIDEO_MESSAGE)
+        {
+            header.InitializeVideo(data_size, 0, msg->header.stream_id);
+        }
+        else
+        {
+            rs_info("ignore the aggregate tag, type=%d, size=%d", type, data_size);
+            reader.Skip(data_size + 4);
+            continue;
+        }
+        header.timestamp = timestamp + delta;
+
+        if (!mix_correct_ && is_monotonically_increase_)
+        {
+            if (last_packet_time_ > 0 && header.timestamp < last_packet_time_)
+            {
+                is_monotonically_increase_ = false;
+                rs_warn("AGGREGATE: stream not monotonically increase, please open mix_correct.");
+            }
+        }
+        last_packet_time_ = header.timestamp;
+
+        SharedPtrMessage *shared_msg = aggregate->Slice(&header, (char *)reader.Ptr(), data_size);
+        reader.Skip(data_size + 4);
+
+        if ((ret = dispatcher_->Enqueue(shared_msg)) != ERROR_SUCCESS)
+        {
+            return ret;
+        }
+    }
 
     return ret;
 }
@@ -480,9 +785,27 @@ int Source::OnDvrRequestSH()
 int Source::OnPublish()
 {
     int ret = ERROR_SUCCESS;
+
+    // only the published sources ingest, the players never start the thread
+    if ((ret = dispatcher_->Start()) != ERROR_SUCCESS)
+    {
+        rs_error("dispatcher start failed.%d", ret);
+        return ret;
+    }
+
+    if (_hub && (ret = _hub->Publish(request_->GetStreamUrl(), this, &hub_stream_)) != ERROR_SUCCESS)
+    {
+        return ret;
+    }
+
     if ((ret = dvr_->OnPublish(request_)) != ERROR_SUCCESS)
     {
         rs_error("start dvr failed.ret=%d",ret);
+        if (hub_stream_)
+        {
+            _hub->Unpublish(hub_stream_, this);
+            hub_stream_ = nullptr;
+        }
         return ret;
     }
     return ret;
@@ -491,7 +814,35 @@ int Source::OnPublish()
 
 void Source::OnUnpublish()
 {
+    // the frames received before unpublish go to dvr and consumers
+    dispatcher_->Flush();
+    DispatchStat &ds = dispatcher_->Stat();
+    rs_trace("dispatch msgs=%lld, batches=%lld, latency avg=%lldus, max=%lldus",
+             ds.nb_msgs, ds.nb_batches, ds.nb_msgs > 0 ? ds.latency_sum_us / ds.nb_msgs : 0, ds.latency_max_us);
+
     dvr_->OnUnpublish();
+    time_shift_->Clear();
+
+    if (hub_stream_)
+    {
+        _hub->Unpublish(hub_stream_, this);
+        hub_stream_ = nullptr;
+        bridges_.clear();
+    }
+
+    PoolStat &ms = SharedPtrMessage::MessagePoolStat();
+    PoolStat &ps = SharedPtrMessage::PayloadPoolStat();
+    rs_trace("message pool hit=%.2f%%, in_use=%lld, high_water=%lld, slabs=%lld; payload pool hit=%.2f%%, in_use=%lld, high_water=%lld, slabs=%lld",
+             ms.HitRate() * 100, ms.in_use, ms.high_water, ms.nb_slabs,
+             ps.HitRate() * 100, ps.in_use, ps.high_water, ps.nb_slabs);
+
+    BufferPoolStat &bs = BufferPool::Stat();
+    rs_trace("payload buffer pool allocs=%lld, avoided=%lld, oversize=%lld, held=%lldB",
+             bs.nb_allocs, bs.nb_reused, bs.nb_oversize, bs.bytes_held);
+
+    WireStat &ws = SharedPtrMessage::WireCacheStat();
+    rs_trace("wire cache builds=%lld, hits=%lld, bytes=%lld, high_water=%lld",
+             ws.nb_builds, ws.nb_hits, ws.bytes, ws.high_water);
 }
 
 int Source::SourceId()
@@ -499,16 +850,76 @@ int Source::SourceId()
     return 0;
 }
 
-int Source::CreateConsumer(Connection* conn, Consumer*& consumer, bool ds, bool dm, bool dg)
+bool Source::IsATC()
+{
+    return atc_;
+}
+
+JitterAlgorithm Source::GetJitterAlgorithm()
+{
+    return ag_;
+}
+
+MessageRing *Source::GetRing()
+{
+    return ring_;
+}
+
+int Source::DumpSequenceHeaders(Consumer *consumer, bool ds, bool dm)
+{
+    int ret = ERROR_SUCCESS;
+
+    if (dm && cache_metadata_ && ( ret = consumer->Enqueue(cache_metadata_, atc_, ag_))!= ERROR_SUCCESS )
+    {
+        rs_error("dispatch metadata failed. ret=%d", ret);
+        return ret;
+    }
+
+    if (ds && cache_sh_audio_ && ( ret = consumer->Enqueue(cache_sh_audio_, atc_, ag_))!= ERROR_SUCCESS )
+    {
+        rs_error("dispatch audio sequence header failed. ret=%d", ret);
+        return ret;
+    }
+
+    if (ds && cache_sh_video_ && ( ret = consumer->Enqueue(cache_sh_video_, atc_, ag_))!= ERROR_SUCCESS )
+    {
+        rs_error("dispatch video sequence header failed. ret=%d", ret);
+        return ret;
+    }
+
+    return ret;
+}
+
+int Source::CreateConsumer(Connection* conn, Consumer*& consumer, bool ds, bool dm, bool dg, double start)
 {
     int ret = ERROR_SUCCESS;
 
+    // not published by this thread, relay from the publisher thread
+    if (_hub && !hub_stream_ && !bridge_ && (ret = subscribe()) != ERROR_SUCCESS)
+    {
+        return ret;
+    }
+
     consumer = new Consumer(this, conn);
     consumers_.push_back(consumer);
 
     // queue_size 单位second
     double queue_size = _config->GetQueueSize(request_->vhost);
-    consumer->SetQueueSize(queue_size);
+    // play with the start, shift back from the live by the time shift buffer
+    time_shift_->Expire();
+    bool time_shift = dg && start > 0 && !time_shift_->Empty();
+    consumer->SetQueueSize(time_shift ? queue_size + start : queue_size);
+
+    if (time_shift)
+    {
+        if ((ret = time_shift_->Dump(consumer, start, atc_, ag_)) != ERROR_SUCCESS)
+        {
+            rs_error("dispatch time shift failed. ret=%d", ret);
+            return ret;
+        }
+        rs_trace("create consumer. queue_size=%.2f, start=%.2f, jitter=%d", queue_size, start, ag_);
+        return ret;
+    }
 
     if (atc_ && !gop_cache_->Empty())
     {
@@ -526,21 +937,8 @@ int Source::CreateConsumer(Connection* conn, Consumer*& consumer, bool ds, bool
         }
     }
 
-    if (dm && cache_metadata_ && ( ret = consumer->Enqueue(cache_metadata_, atc_, ag_))!= ERROR_SUCCESS )
-    {
-        rs_error("dispatch metadata failed. ret=%d", ret);
-        return ret;
-    }
-
-    if (ds && cache_sh_audio_ && ( ret = consumer->Enqueue(cache_sh_audio_, atc_, ag_))!= ERROR_SUCCESS )
+    if ((ret = DumpSequenceHeaders(consumer, ds, dm)) != ERROR_SUCCESS)
     {
-        rs_error("dispatch audio sequence header failed. ret=%d", ret);
-        return ret;
-    }
-
-    if (ds && cache_sh_video_ && ( ret = consumer->Enqueue(cache_sh_video_, atc_, ag_))!= ERROR_SUCCESS )
-    {
-        rs_error("dispatch video sequence header failed. ret=%d", ret);
         return ret;
     }
 
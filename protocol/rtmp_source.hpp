@@ -3,6 +3,9 @@
 #include <common/core.hpp>
 #include <common/connection.hpp>
 #include <common/queue.hpp>
+#include <common/thread.hpp>
+
+#include <deque>
 #include <protocol/rtmp_stack.hpp>
 #include <protocol/rtmp_jitter.hpp>
 #include <protocol/rtmp_consumer.hpp>
@@ -14,6 +17,9 @@ namespace rtmp
 
 class Source;
 class GopCache;
+class TimeShift;
+class SourceBridge;
+struct HubStream;
 
 class ISourceHandler
 {
@@ -26,6 +32,57 @@ public:
 };
 
 
+struct DispatchStat
+{
+    int64_t nb_msgs;
+    int64_t nb_batches;
+    // from ingest to dispatch
+    int64_t latency_sum_us;
+    int64_t latency_max_us;
+};
+
+/**
+ * the fan-out stage of a source, decoupled from the publisher recv coroutine.
+ * the ingest only enqueues the message, the dispatcher coroutine fans out the queued
+ * messages in batches to the ring, dvr, gop cache and bridges, when the recv coroutine
+ * yields, so the viewers never delay the read of publisher socket.
+ */
+class SourceDispatcher : public internal::IThreadHandler
+{
+public:
+    SourceDispatcher(Source *source);
+    virtual ~SourceDispatcher();
+
+public:
+    // starts the thread once, the later calls are ignored
+    virtual int32_t Start();
+    // takes the ownership of msg, return the error of previous dispatch
+    virtual int Enqueue(SharedPtrMessage *msg);
+    // dispatch the queued messages in the caller coroutine
+    virtual void Flush();
+    virtual DispatchStat &Stat();
+    // internal::IThreadHandler
+    virtual int32_t Cycle() override;
+
+private:
+    void dispatch();
+
+private:
+    struct DispatchItem
+    {
+        SharedPtrMessage *msg;
+        int64_t ingest_us;
+    };
+
+    Source *source_;
+    std::deque<DispatchItem> queue_;
+    st_cond_t cond_;
+    bool waiting_;
+    int error_;
+    internal::Thread *thread_;
+    DispatchStat stat_;
+};
+
 class Source
 {
 public:
@@ -38,16 +95,27 @@ public:
     virtual void OnConsumerDestory(Consumer *consumer);
     virtual int OnAudio(CommonMessage *msg);
     virtual int OnVideo(CommonMessage *msg);
+    // split to the audio and video messages, which are the slices of the aggregate
+    virtual int OnAggregate(CommonMessage *msg);
     virtual int OnMetadata(CommonMessage *msg, rtmp::OnMetadataPacket *pkt);
+    // the message from the source of publisher thread, by the bridge
+    virtual int OnRelay(SharedPtrMessage *msg);
+    // fan-out the ingested message, by the dispatcher
+    virtual int Dispatch(SharedPtrMessage *msg);
     virtual int OnDvrRequestSH();
     virtual int OnPublish();
     virtual void OnUnpublish();
     virtual int SourceId();
+    virtual bool IsATC();
+    virtual JitterAlgorithm GetJitterAlgorithm();
+    virtual MessageRing *GetRing();
+    virtual int DumpSequenceHeaders(Consumer *consumer, bool ds = true, bool dm = true);
     virtual int CreateConsumer(Connection* conn,
                                 Consumer*& consumer,
                                 bool ds = true,
                                 bool dm = true,
-                                bool dg = true);
+                                bool dg = true,
+                                double start = -2);
 protected:
     static Source *Fetch(Request *r);
 
@@ -55,9 +123,15 @@ protected:
 private:
     int on_audio_impl(SharedPtrMessage *msg);
     int on_video_impl(SharedPtrMessage *msg);
+    int on_metadata_impl(SharedPtrMessage *msg);
+    // fan-out to the relay sources of other scheduler threads
+    void relay_remote(SharedPtrMessage *msg, bool droppable, bool is_keyframe);
+    void prime_bridge(SourceBridge *bridge);
+    int subscribe();
 
 private:
-    static std::map<std::string, Source *> pool_;
+    // each scheduler thread has its own sources
+    static thread_local std::map<std::string, Source *> pool_;
     Request *request_;
     bool atc_;
     ISourceHandler *handler_;
@@ -73,6 +147,15 @@ private:
     MixQueue<SharedPtrMessage> *mix_queue_;
     Dvr *dvr_;
     GopCache* gop_cache_;
+    TimeShift *time_shift_;
+    MessageRing *ring_;
+    // published by this thread
+    HubStream *hub_stream_;
+    int hub_version_;
+    std::vector<SourceBridge *> bridges_;
+    // relayed from the publisher thread, owned by the hub
+    SourceBridge *bridge_;
+    SourceDispatcher *dispatcher_;
 };
 
 } //namespace rtmp
@@ -2,10 +2,148 @@
 #include <protocol/rtmp_stack.hpp>
 #include <protocol/gop_cache.hpp>
 #include <protocol/rtmp_consts.hpp>
+#include <common/timer.hpp>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
 
 namespace rtmp
 {
 
+// free the pins completed by the ranges, return true when any completed
+static bool release_zerocopy_pins(ZeroCopyPins &pins, const std::vector<std::pair<uint32_t, uint32_t> > &ranges)
+{
+    // tcp completes in order, the max completed id releases all pins before it
+    bool completed = false;
+    uint32_t max_id = 0;
+    for (size_t i = 0; i < ranges.size(); i++)
+    {
+        if (!completed || (int32_t)(ranges[i].second - max_id) > 0)
+        {
+            max_id = ranges[i].second;
+            completed = true;
+        }
+    }
+
+    while (completed && !pins.empty() && (int32_t)(pins.front().first - max_id) <= 0)
+    {
+        rs_freep(pins.front().second);
+        pins.pop_front();
+    }
+    return completed;
+}
+
+ZeroCopyReaper::ZeroCopyReaper() : cond_(nullptr), thread_(nullptr)
+{
+
+}
+
+ZeroCopyReaper::~ZeroCopyReaper()
+{
+    if (thread_)
+    {
+        thread_->Stop();
+        rs_freep(thread_);
+    }
+    if (cond_)
+    {
+        st_cond_destroy(cond_);
+    }
+    for (size_t i = 0; i < graves_.size(); i++)
+    {
+        Grave *grave = graves_[i];
+        ::close(grave->fd);
+        while (!grave->pins.empty())
+        {
+            rs_freep(grave->pins.front().second);
+            grave->pins.pop_front();
+        }
+        rs_freep(grave);
+    }
+}
+
+int32_t ZeroCopyReaper::Initialize()
+{
+    int32_t ret = ERROR_SUCCESS;
+
+    cond_ = st_cond_new();
+    thread_ = new internal::Thread("zerocopy-reaper", this, 0, true);
+    if ((ret = thread_->Start()) != ERROR_SUCCESS)
+    {
+        rs_error("start zerocopy reaper failed, ret=%d", ret);
+        return ret;
+    }
+
+    return ret;
+}
+
+void ZeroCopyReaper::Push(int fd, ZeroCopyPins &pins)
+{
+    // the fin is sent after the data in flight, the user timeout bounds a dead peer
+    ::shutdown(fd, SHUT_RDWR);
+#ifdef TCP_USER_TIMEOUT
+    int v = RTMP_ZEROCOPY_USER_TIMEOUT_MS;
+    setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &v, sizeof(v));
+#endif
+
+    Grave *grave = new Grave();
+    grave->fd = fd;
+    grave->pins.swap(pins);
+    grave->deadline = Utils::GetSteadyMilliSeconds() + RTMP_ZEROCOPY_USER_TIMEOUT_MS * 2;
+    graves_.push_back(grave);
+    st_cond_signal(cond_);
+}
+
+int32_t ZeroCopyReaper::Cycle()
+{
+    int32_t ret = ERROR_SUCCESS;
+
+    if (graves_.empty())
+    {
+        st_cond_wait(cond_);
+        return ret;
+    }
+
+    _wheel->Sleep(RTMP_ZEROCOPY_REAP_INTERVAL_MS * 1000);
+
+    int64_t now = Utils::GetSteadyMilliSeconds();
+    for (std::vector<Grave *>::iterator it = graves_.begin(); it != graves_.end();)
+    {
+        Grave *grave = *it;
+
+        std::vector<std::pair<uint32_t, uint32_t> > ranges;
+        ReapZeroCopyFd(grave->fd, ranges);
+        release_zerocopy_pins(grave->pins, ranges);
+
+        // the kernel never completes, the buffers reused only change the bytes of a dead connection
+        if (!grave->pins.empty() && now >= grave->deadline)
+        {
+            rs_warn("zerocopy fd=%d not completed, free %d pins", grave->fd, (int)grave->pins.size());
+            while (!grave->pins.empty())
+            {
+                rs_freep(grave->pins.front().second);
+                grave->pins.pop_front();
+            }
+        }
+
+        if (grave->pins.empty())
+        {
+            ::close(grave->fd);
+            rs_freep(grave);
+            it = graves_.erase(it);
+            continue;
+        }
+        ++it;
+    }
+
+    return ret;
+}
+
+// the reaper of the scheduler thread, created by the first protocol freed with pins
+static thread_local ZeroCopyReaper *_zerocopy_reaper = nullptr;
+
 static void vhost_resolve(std::string &vhost, std::string &app, std::string &param)
 {
     size_t pos = std::string::npos;
@@ -52,12 +190,60 @@ static std::string generate_stream_url(const std::string &vhost, const std::stri
         retstr = vhost;
     }
     retstr += "/";
-    retstr += "app";
+    retstr += app;
     retstr += "/";
-    retstr += "stream";
+    retstr += stream;
     return retstr;
 }
 
+#define RTMP_HANDOFF_CHUNK_STREAM_SIZE 30
+
+static int handoff_string_size(const std::string &value)
+{
+    return 2 + (int)value.length();
+}
+
+static void handoff_write_string(BufferManager *manager, const std::string &value)
+{
+    manager->Write2Bytes((int16_t)value.length());
+    manager->WriteString(value);
+}
+
+static int handoff_read_string(BufferManager *manager, std::string &value)
+{
+    int ret = ERROR_SUCCESS;
+    if (!manager->Require(2))
+    {
+        ret = ERROR_SYSTEM_WORKER_HANDOFF;
+        rs_error("handoff requires 2 bytes string length, ret=%d", ret);
+        return ret;
+    }
+    int len = (uint16_t)manager->Read2Bytes();
+    if (!manager->Require(len))
+    {
+        ret = ERROR_SYSTEM_WORKER_HANDOFF;
+        rs_error("handoff requires %d bytes string, ret=%d", len, ret);
+        return ret;
+    }
+    value = manager->ReadString(len);
+    return ret;
+}
+
+static void handoff_write_double(BufferManager *manager, double value)
+{
+    int64_t v;
+    memcpy(&v, &value, sizeof(int64_t));
+    manager->Write8Bytes(v);
+}
+
+static double handoff_read_double(BufferManager *manager)
+{
+    int64_t v = manager->Read8Bytes();
+    double value;
+    memcpy(&value, &v, sizeof(double));
+    return value;
+}
+
 extern void DiscoveryTcUrl(const std::string &tc_url,
                             std::string &schema,
                             std::string &host,
@@ -109,6 +295,7 @@ extern void DiscoveryTcUrl(const std::string &tc_url,
 
 Request::Request() : object_encoding(3),
                      duration(-1),
+                     start(-2),
                      args(nullptr)
 {
 }
@@ -144,7 +331,10 @@ Request *Request::Copy()
     cp->swf_url = swf_url;
     cp->tc_url = tc_url;
     cp->vhost = vhost;
+    cp->stream = stream;
+    cp->page_url = page_url;
     cp->duration = duration;
+    cp->start = start;
     if (args)
     {
         cp->args = args->Copy()->ToObject();
@@ -175,6 +365,66 @@ void Request::Update(Request *req)
     }
 }
 
+int Request::HandoffSize()
+{
+    return handoff_string_size(ip) + handoff_string_size(tc_url) + handoff_string_size(page_url) +
+           handoff_string_size(swf_url) + handoff_string_size(schema) + handoff_string_size(vhost) +
+           handoff_string_size(host) + handoff_string_size(port) + handoff_string_size(app) +
+           handoff_string_size(param) + handoff_string_size(stream) + 8 + 8 + 8;
+}
+
+int Request::EncodeHandoff(BufferManager *manager)
+{
+    int ret = ERROR_SUCCESS;
+    if (!manager->Require(HandoffSize()))
+    {
+        ret = ERROR_SYSTEM_WORKER_HANDOFF;
+        rs_error("handoff requires %d bytes request, ret=%d", HandoffSize(), ret);
+        return ret;
+    }
+
+    handoff_write_string(manager, ip);
+    handoff_write_string(manager, tc_url);
+    handoff_write_string(manager, page_url);
+    handoff_write_string(manager, swf_url);
+    handoff_write_string(manager, schema);
+    handoff_write_string(manager, vhost);
+    handoff_write_string(manager, host);
+    handoff_write_string(manager, port);
+    handoff_write_string(manager, app);
+    handoff_write_string(manager, param);
+    handoff_write_string(manager, stream);
+    handoff_write_double(manager, object_encoding);
+    handoff_write_double(manager, duration);
+    handoff_write_double(manager, start);
+    return ret;
+}
+
+int Request::DecodeHandoff(BufferManager *manager)
+{
+    int ret = ERROR_SUCCESS;
+
+    std::string *fields[] = {&ip, &tc_url, &page_url, &swf_url, &schema, &vhost,
+                             &host, &port, &app, &param, &stream};
+    for (int i = 0; i < (int)(sizeof(fields) / sizeof(fields[0])); i++)
+    {
+        if ((ret = handoff_read_string(manager, *fields[i])) != ERROR_SUCCESS)
+        {
+            return ret;
+        }
+    }
+
+    if (!manager->Require(24))
+    {
+        ret = ERROR_SYSTEM_WORKER_HANDOFF;
+        rs_error("handoff requires 24 bytes request, ret=%d", ret);
+        return ret;
+    }
+    object_encoding = handoff_read_double(manager);
+    duration = handoff_read_double(manager);
+    start = handoff_read_double(manager);
+    return ret;
+}
 
 AckWindowSize::AckWindowSize() : window(0),
                                  sequence_number(0),
@@ -193,12 +443,24 @@ AckWindowSize::~AckWindowSize()
 
 Protocol::Protocol(IProtocolReaderWriter *rw) : rw_(rw),
                                                 in_chunk_size_(RTMP_CONSTS_RTMP_PROTOCOL_CHUNK_SIZE),
-                                                out_chunk_size_(RTMP_CONSTS_RTMP_PROTOCOL_CHUNK_SIZE)
+                                                out_chunk_size_(RTMP_CONSTS_RTMP_PROTOCOL_CHUNK_SIZE),
+                                                zerocopy_(nullptr),
+                                                zerocopy_threshold_(0),
+                                                header_compression_(false),
+                                                nb_header_saved_bytes_(0),
+                                                aggregate_size_(0),
+                                                nb_aggregated_msgs_(0),
+                                                nb_aggregates_(0),
+                                                nb_payload_bytes_(0),
+                                                nb_copied_bytes_(0),
+                                                nb_continuation_chunks_(0)
 
 {
     nb_out_iovs_ = RTMP_IOVS_MAX;
     out_iovs_ = (iovec*)malloc(nb_out_iovs_ * sizeof(iovec));
 
+    memset(out_cs_, 0, sizeof(out_cs_));
+
     in_buffer_ = new FastBuffer;
     cs_cache_ = new ChunkStream *[RTMP_CHUNK_STREAM_CHCAHE];
     for (int cid = 0;cid < RTMP_CHUNK_STREAM_CHCAHE; cid++)
@@ -211,6 +473,19 @@ Protocol::Protocol(IProtocolReaderWriter *rw) : rw_(rw),
 
 Protocol::~Protocol()
 {
+    if (nb_payload_bytes_ > 0)
+    {
+        rs_info("recv payload %lld bytes, copied %lld bytes, fast fmt3 chunks %lld", nb_payload_bytes_, nb_copied_bytes_, nb_continuation_chunks_);
+    }
+    if (nb_header_saved_bytes_ > 0)
+    {
+        rs_info("delta chunk headers saved %lld bytes", nb_header_saved_bytes_);
+    }
+    if (nb_aggregates_ > 0)
+    {
+        rs_info("packed %lld msgs to %lld aggregates", nb_aggregated_msgs_, nb_aggregates_);
+    }
+
     {
         std::map<int, ChunkStream *>::iterator it;
         for (it = chunk_stream_.begin(); it != chunk_stream_.end();)
@@ -239,6 +514,51 @@ Protocol::~Protocol()
     }
     rs_freep(cs_cache_);
     rs_freep(out_iovs_);
+
+    // the pages are pinned by kernel until completed, the reaper keeps the pins by a dup fd
+    ReapZeroCopy();
+    int fd = zerocopy_pins_.empty() ? -1 : zerocopy_->DupZeroCopy();
+    if (fd >= 0 && !_zerocopy_reaper)
+    {
+        _zerocopy_reaper = new ZeroCopyReaper();
+        if (_zerocopy_reaper->Initialize() != ERROR_SUCCESS)
+        {
+            rs_freep(_zerocopy_reaper);
+        }
+    }
+    if (fd >= 0 && _zerocopy_reaper)
+    {
+        _zerocopy_reaper->Push(fd, zerocopy_pins_);
+    }
+    else if (fd >= 0)
+    {
+        ::close(fd);
+    }
+
+    while (!zerocopy_pins_.empty())
+    {
+        rs_freep(zerocopy_pins_.front().second);
+        zerocopy_pins_.pop_front();
+    }
+}
+
+void *Protocol::operator new(size_t size)
+{
+    if (size != sizeof(Protocol))
+    {
+        return ::operator new(size);
+    }
+    return SlabPool<Protocol>::Alloc();
+}
+
+void Protocol::operator delete(void *p, size_t size)
+{
+    if (size != sizeof(Protocol))
+    {
+        ::operator delete(p);
+        return;
+    }
+    SlabPool<Protocol>::Free(p);
 }
 
 void Protocol::SetRecvTimeout(int64_t timeout_us)
@@ -391,25 +711,14 @@ int Protocol::ReadMessageHeader(ChunkStream *cs, char fmt)
         return ret;
     }
 
-    // char *ptr = in_buffer_->ReadSlice(mh_size);
+    // the header is in buffer after grow, read the fields unchecked
     char *ptr;
-    BufferManager manager;
-    // if ((ret = manager.Initialize(ptr, mh_size)) != ERROR_SUCCESS)
-    // {
-    //     rs_error("initialize buffer manager failed, ret=%d", ret);
-    //     return ret;
-    // }
-
     if (fmt <= RTMP_FMT_TYPE2)
     {
         ptr = in_buffer_->ReadSlice(mh_size);
-        if ((ret = manager.Initialize(ptr, mh_size)) != ERROR_SUCCESS)
-        {
-            rs_error("initialize buffer manager failed, ret=%d", ret);
-            return ret;
-        }
+        ByteReader reader(ptr, mh_size);
 
-        cs->header.timestamp_delta = manager.Read3Bytes();
+        cs->header.timestamp_delta = reader.Read3();
         cs->extended_timestamp = (cs->header.timestamp_delta >= RTMP_EXTENDED_TIMESTAMPE);
 
         if (!cs->extended_timestamp)
@@ -428,7 +737,7 @@ int Protocol::ReadMessageHeader(ChunkStream *cs, char fmt)
 
         if (fmt <= RTMP_FMT_TYPE1)
         {
-            int32_t payload_length = manager.Read3Bytes();
+            int32_t payload_length = reader.Read3();
 
             if (!is_first_msg_of_chunk  && cs->header.payload_length != payload_length)
             {
@@ -438,11 +747,11 @@ int Protocol::ReadMessageHeader(ChunkStream *cs, char fmt)
             }
 
             cs->header.payload_length = payload_length;
-            cs->header.message_type = manager.Read1Bytes();
+            cs->header.message_type = reader.Read1();
 
             if (fmt <= RTMP_FMT_TYPE0)
             {
-                cs->header.stream_id = manager.Read4Bytes();
+                cs->header.stream_id = reader.Read4();
                 rs_verbose("header read completed, fmt=%d, mh_size=%d, ext_time=%d, time=%lld, payload=%d, type=%d, sid=%d", fmt, mh_size, cs->extended_timestamp, cs->header.timestamp, cs->header.payload_length, cs->header.message_type, cs->header.stream_id);
             }
         }
@@ -476,9 +785,7 @@ int Protocol::ReadMessageHeader(ChunkStream *cs, char fmt)
         }
 
         ptr = in_buffer_->ReadSlice(4);
-        manager.Initialize(ptr, 4);
-
-        uint32_t timestamp = manager.Read4Bytes();
+        uint32_t timestamp = bytes::Read4(ptr);
         timestamp &= 0x7fffffff;
 
 
@@ -532,7 +839,15 @@ int Protocol::ReadMessagePayload(ChunkStream *cs, CommonMessage **pmsg)
         cs->msg->CreatePlayload(cs->header.payload_length);
     }
 
-    if ((ret = in_buffer_->Grow(rw_, payload_size)) != ERROR_SUCCESS)
+    // 按照偏移量进行读取, the bytes not buffered yet are read to the payload directly
+    int32_t nb_copied = 0;
+    int32_t nb_read = 0;
+    ret = in_buffer_->ReadInto(rw_, cs->msg->payload + cs->msg->size, payload_size, &nb_copied, &nb_read);
+    cs->msg->size += nb_read;
+    nb_payload_bytes_ += nb_read;
+    nb_copied_bytes_ += nb_copied;
+
+    if (ret != ERROR_SUCCESS)
     {
         // if (ret != ERROR_SOCKET_TIMEOUT && !IsClientGracefullyClose(ret))
         if (!IsClientGracefullyClose(ret))
@@ -541,9 +856,6 @@ int Protocol::ReadMessagePayload(ChunkStream *cs, CommonMessage **pmsg)
         }
         return ret;
     }
-    // 按照偏移量进行读取
-    memcpy(cs->msg->payload + cs->msg->size, in_buffer_->ReadSlice(payload_size), payload_size);
-    cs->msg->size += payload_size;
 
     rs_verbose("chunk payload read compeleted, payload size=%d", payload_size);
 
@@ -562,52 +874,93 @@ int Protocol::ReadMessagePayload(ChunkStream *cs, CommonMessage **pmsg)
     return ret;
 }
 
-int Protocol::RecvInterlacedMessage(CommonMessage **pmsg)
+int Protocol::ReadContinuationChunks(ChunkStream *cs, CommonMessage **pmsg)
 {
     int ret = ERROR_SUCCESS;
-    char fmt = 0;
-    int cid = 0;
-    if ((ret = ReadBasicHeader(fmt, cid)) != ERROR_SUCCESS)
+
+    // only the one byte basic header, the extended timestamp goes to ReadMessageHeader
+    if (cs->cid < 2 || cs->cid > 63 || cs->extended_timestamp)
     {
-        if (!IsClientGracefullyClose(ret))
+        return ret;
+    }
+
+    // the header of fmt3 never changes the partial message, never read socket for it
+    char c3 = (char)(0xC0 | cs->cid);
+    while (cs->msg && in_buffer_->Size() > 0 && in_buffer_->Bytes()[0] == c3)
+    {
+        in_buffer_->Skip(1);
+        cs->msg_count++;
+        nb_continuation_chunks_++;
+
+        int32_t payload_size = rs_min(cs->header.payload_length - cs->msg->size, in_chunk_size_);
+        int32_t nb_copied = 0;
+        int32_t nb_read = 0;
+        ret = in_buffer_->ReadInto(rw_, cs->msg->payload + cs->msg->size, payload_size, &nb_copied, &nb_read);
+        cs->msg->size += nb_read;
+        nb_payload_bytes_ += nb_read;
+        nb_copied_bytes_ += nb_copied;
+
+        if (ret != ERROR_SUCCESS)
         {
-            rs_error("read basic header failed, ret=%d", ret);
+            if (!IsClientGracefullyClose(ret))
+            {
+                rs_error("read continuation payload failed, required_size=%d, ret=%d", payload_size, ret);
+            }
+            return ret;
+        }
+
+        if (cs->header.payload_length == cs->msg->size)
+        {
+            *pmsg = cs->msg;
+            cs->msg = nullptr;
+            return ret;
         }
-        return ret;
     }
 
-    rs_verbose("read basic header success, fmt=%d, cid=%d", fmt, cid);
-    ChunkStream *cs = nullptr;
+    return ret;
+}
+
+ChunkStream *Protocol::fetch_chunk_stream(int cid)
+{
     if (cid < RTMP_CHUNK_STREAM_CHCAHE)
     {
-        rs_verbose("cs-cache hint, cid=%d", cid);
-        cs = cs_cache_[cid];
-        rs_verbose("cache chunk stream:fmt=%d,cid=%d,size=%d,msg(type=%d,size=%d,time=%lld,sid=%d)",
-                    fmt, cid, (cs->msg ? cs->msg->size : 0),
-                    cs->header.message_type, cs->header.payload_length,
-                    cs->header.timestamp, cs->header.stream_id);
+        return cs_cache_[cid];
+    }
 
+    std::map<int, ChunkStream *>::iterator it = chunk_stream_.find(cid);
+    if (it != chunk_stream_.end())
+    {
+        return it->second;
     }
-    else
+
+    ChunkStream *cs = new ChunkStream(cid);
+    cs->header.perfer_cid = cid;
+    chunk_stream_[cid] = cs;
+    rs_verbose("cache new chunk stream:cid=%d", cid);
+    return cs;
+}
+
+int Protocol::RecvInterlacedMessage(CommonMessage **pmsg)
+{
+    int ret = ERROR_SUCCESS;
+    char fmt = 0;
+    int cid = 0;
+    if ((ret = ReadBasicHeader(fmt, cid)) != ERROR_SUCCESS)
     {
-        if (chunk_stream_.find(cid) == chunk_stream_.end())
-        {
-            cs = new ChunkStream(cid);
-            cs->header.perfer_cid = cid;
-            chunk_stream_[cid] = cs;
-            rs_verbose("cache new chunk stream:fmt=%d, cid=%d", fmt, cid);
-        }
-        else
+        if (!IsClientGracefullyClose(ret))
         {
-            cs = chunk_stream_[cid];
-            rs_verbose("cache chunk stream:fmt=%d,cid=%d,size=%d,msg(type=%d,size=%d,time=%lld,sid=%d)",
-                        fmt, cid, (cs->msg ? cs->msg->size : 0),
-                        cs->header.message_type, cs->header.payload_length,
-                        cs->header.timestamp, cs->header.stream_id);
+            rs_error("read basic header failed, ret=%d", ret);
         }
-
+        return ret;
     }
 
+    rs_verbose("read basic header success, fmt=%d, cid=%d", fmt, cid);
+    ChunkStream *cs = fetch_chunk_stream(cid);
+    rs_verbose("cache chunk stream:fmt=%d,cid=%d,size=%d,msg(type=%d,size=%d,time=%lld,sid=%d)",
+                fmt, cid, (cs->msg ? cs->msg->size : 0),
+                cs->header.message_type, cs->header.payload_length,
+                cs->header.timestamp, cs->header.stream_id);
+
     if (ret = ReadMessageHeader(cs, fmt) != ERROR_SUCCESS)
     {
         if (ret != ERROR_SOCKET_TIMEOUT && !IsClientGracefullyClose(ret))
@@ -630,6 +983,11 @@ int Protocol::RecvInterlacedMessage(CommonMessage **pmsg)
         return ret;
     }
 
+    if (!msg && (ret = ReadContinuationChunks(cs, &msg)) != ERROR_SUCCESS)
+    {
+        return ret;
+    }
+
     if (!msg)
     {
         rs_verbose("got part of message success,size=%d,message(type=%d,size=%d,time=%lld,size=%d)", cs->header.payload_length, cs->header.message_type, cs->msg->size, cs->header.timestamp, cs->header.stream_id);
@@ -902,8 +1260,8 @@ int Protocol::DoSimpleSend(MessageHeader *header, char *payload, int size)
         int nbh = 0;
         if (p == payload)
         {
-            nbh = chunk_header_c0(header->perfer_cid, header->timestamp, header->payload_length,
-                                    header->message_type, header->stream_id, c0c3);
+            nbh = chunk_header_first(header->perfer_cid, header->timestamp, header->payload_length,
+                                     header->message_type, header->stream_id, true, c0c3);
 
         } else {
             nbh = chunk_header_c3(header->perfer_cid, header->timestamp, c0c3);
@@ -1001,6 +1359,11 @@ int Protocol::SendAndFreeMessage(SharedPtrMessage** msgs, int nb_msgs, int strea
         }
     }
 
+    if (aggregate_size_ > 0)
+    {
+        nb_msgs = pack_aggregate(msgs, nb_msgs, stream_id);
+    }
+
     int ret = DoSendMessages(msgs, nb_msgs);
     for (int i = 0;i < nb_msgs;i++)
     {
@@ -1079,6 +1442,190 @@ void Protocol::SetAutoResponse(bool v)
     auto_response_when_recv_ = v;
 }
 
+void Protocol::SetZeroCopy(int threshold)
+{
+    zerocopy_ = dynamic_cast<IZeroCopyWriter *>(rw_);
+    if (!zerocopy_ || threshold <= 0 || !zerocopy_->EnableZeroCopy())
+    {
+        zerocopy_threshold_ = 0;
+        return;
+    }
+    zerocopy_threshold_ = threshold;
+}
+
+void Protocol::SetHeaderCompression(bool v)
+{
+    header_compression_ = v;
+}
+
+void Protocol::SetAggregate(int max_size)
+{
+    aggregate_size_ = rs_max(max_size, 0);
+}
+
+int Protocol::pack_aggregate(SharedPtrMessage **msgs, int nb_msgs, int stream_id)
+{
+    int count = 0;
+    int i = 0;
+    while (i < nb_msgs)
+    {
+        SharedPtrMessage *msg = msgs[i];
+        if (!msg || !msg->IsAV())
+        {
+            msgs[count++] = msgs[i++];
+            continue;
+        }
+
+        // the run of av messages in timestamp order, fit in the aggregate
+        int size = RTMP_AGGREGATE_TAG_HEADER_SIZE + msg->size + 4;
+        int j = i + 1;
+        while (j < nb_msgs && msgs[j] && msgs[j]->IsAV() && msgs[j]->timestamp >= msgs[j - 1]->timestamp)
+        {
+            int tag_size = RTMP_AGGREGATE_TAG_HEADER_SIZE + msgs[j]->size + 4;
+            if (size + tag_size > aggregate_size_)
+            {
+                break;
+            }
+            size += tag_size;
+            j++;
+        }
+
+        if (j - i < 2)
+        {
+            msgs[count++] = msgs[i++];
+            continue;
+        }
+
+        SharedPtrMessage *aggregate = SharedPtrMessage::Aggregate(msgs + i, j - i, stream_id);
+        nb_aggregated_msgs_ += j - i;
+        nb_aggregates_++;
+        for (; i < j; i++)
+        {
+            rs_freep(msgs[i]);
+        }
+        msgs[count++] = aggregate;
+    }
+
+    for (int k = count; k < nb_msgs; k++)
+    {
+        msgs[k] = nullptr;
+    }
+    return count;
+}
+
+int Protocol::chunk_header_first(int cid, uint32_t timestamp, int32_t payload_length,
+                                 int8_t message_type, int32_t stream_id, bool delta, char *buf)
+{
+    OutChunkStream *ocs = &out_cs_[cid & 0x3f];
+
+    // the peer adds the delta to its last timestamp, so the delta never goes backward,
+    // and no extended timestamp for simple
+    if (!header_compression_ || !delta || !ocs->valid || ocs->stream_id != stream_id ||
+        timestamp < ocs->timestamp || timestamp >= RTMP_TIMESTAMP_24BIT_MAX)
+    {
+        ocs->valid = true;
+        ocs->has_delta = false;
+        ocs->timestamp = timestamp;
+        ocs->delta = 0;
+        ocs->payload_length = payload_length;
+        ocs->message_type = message_type;
+        ocs->stream_id = stream_id;
+        return chunk_header_c0(cid, timestamp, payload_length, message_type, stream_id, buf);
+    }
+
+    uint32_t timestamp_delta = timestamp - ocs->timestamp;
+    char *pp = nullptr;
+    char *p = buf;
+
+    if (payload_length == ocs->payload_length && message_type == ocs->message_type)
+    {
+        if (ocs->has_delta && timestamp_delta == ocs->delta)
+        {
+            // fmt3, repeats the last delta
+            *p++ = 0xC0 | (0x3f & cid);
+        }
+        else
+        {
+            // fmt2, only the delta
+            *p++ = 0x80 | (0x3f & cid);
+            pp = (char *)&timestamp_delta;
+            *p++ = pp[2];
+            *p++ = pp[1];
+            *p++ = pp[0];
+        }
+    }
+    else
+    {
+        // fmt1, the delta, length and type
+        *p++ = 0x40 | (0x3f & cid);
+        pp = (char *)&timestamp_delta;
+        *p++ = pp[2];
+        *p++ = pp[1];
+        *p++ = pp[0];
+        pp = (char *)&payload_length;
+        *p++ = pp[2];
+        *p++ = pp[1];
+        *p++ = pp[0];
+        *p++ = message_type;
+    }
+
+    ocs->has_delta = true;
+    ocs->timestamp = timestamp;
+    ocs->delta = timestamp_delta;
+    ocs->payload_length = payload_length;
+    ocs->message_type = message_type;
+
+    nb_header_saved_bytes_ += RTMP_FMT0_SHORT_HEADER_SIZE - (p - buf);
+    return (int)(p - buf);
+}
+
+int Protocol::send_zerocopy(SharedPtrMessage *msg, char *wire, int size)
+{
+    int ret = ERROR_SUCCESS;
+
+    iovec iov;
+    iov.iov_base = wire;
+    iov.iov_len = size;
+
+    uint32_t first = 0;
+    uint32_t last = 0;
+    ret = zerocopy_->WriteEvZeroCopy(&iov, 1, &first, &last);
+
+    // the pages are referenced by kernel for the ids sent, even when failed
+    if ((int32_t)(last - first) >= 0)
+    {
+        zerocopy_pins_.push_back(std::make_pair(last, msg->Copy()));
+    }
+
+    ReapZeroCopy();
+    return ret;
+}
+
+bool Protocol::ReapZeroCopy()
+{
+    if (!zerocopy_)
+    {
+        return false;
+    }
+
+    std::vector<std::pair<uint32_t, uint32_t> > ranges;
+    zerocopy_->ReapZeroCopy(ranges);
+    release_zerocopy_pins(zerocopy_pins_, ranges);
+    return !ranges.empty();
+}
+
+iovec *Protocol::reserve_iovs(int iov_index, int nb)
+{
+    if (iov_index + nb > nb_out_iovs_)
+    {
+        rs_warn("resize out_iovs %d => %d", nb_out_iovs_, nb_out_iovs_ + RTMP_IOVS_MAX);
+        nb_out_iovs_ += RTMP_IOVS_MAX;
+        int relloc_size = sizeof(iovec) * nb_out_iovs_;
+        out_iovs_ = (iovec*)realloc(out_iovs_, relloc_size);
+    }
+    return out_iovs_ + iov_index;
+}
+
 int Protocol::DoSendMessages(SharedPtrMessage** msgs, int nb_msgs)
 {
     int ret = ERROR_SUCCESS;
@@ -1100,13 +1647,79 @@ int Protocol::DoSendMessages(SharedPtrMessage** msgs, int nb_msgs)
             rs_info("ignore empty message");
             continue;
         }
+        SharedMesageHeader *h = msg->GetHeader();
+        // the serialized chunks shared with other consumers, after the first header of
+        // this consumer
+        char *wire = nullptr;
+        int wire_size = msg->WireFormat(out_chunk_size_, &wire);
+        if (wire_size > 0 && zerocopy_threshold_ > 0 && wire_size >= zerocopy_threshold_)
+        {
+            iovs = reserve_iovs(iov_index, 1);
+            int nbh = chunk_header_first(h->perfer_cid, msg->timestamp, h->payload_length, h->message_type, msg->stream_id, true, c0c3_cache);
+            iovs[0].iov_base = c0c3_cache;
+            iovs[0].iov_len = nbh;
+            iov_index += 1;
+
+            if ((ret = SendLargeIovs(rw_, out_iovs_, iov_index, nullptr)) != ERROR_SUCCESS)
+            {
+                return ret;
+            }
+            iov_index = 0;
+            iovs = out_iovs_ + iov_index;
+            c0c3_cache_index = 0;
+            c0c3_cache = out_c0c3_caches_ + c0c3_cache_index;
+
+            if ((ret = send_zerocopy(msg, wire, wire_size)) != ERROR_SUCCESS)
+            {
+                return ret;
+            }
+            continue;
+        }
+        if (wire_size > 0)
+        {
+            iovs = reserve_iovs(iov_index, 2);
+            int nbh = chunk_header_first(h->perfer_cid, msg->timestamp, h->payload_length, h->message_type, msg->stream_id, true, c0c3_cache);
+            iovs[0].iov_base = c0c3_cache;
+            iovs[0].iov_len = nbh;
+            iovs[1].iov_base = wire;
+            iovs[1].iov_len = wire_size;
+
+            iov_index += 2;
+            iovs = out_iovs_ + iov_index;
+
+            c0c3_cache_index += nbh;
+            c0c3_cache = out_c0c3_caches_ + c0c3_cache_index;
+
+            if (RTMP_C0C3_HEADERS_MAX - c0c3_cache_index < RTMP_FMT0_HEADER_SIZE) {
+                if ((ret = SendLargeIovs(rw_, out_iovs_, iov_index, nullptr)) != ERROR_SUCCESS)
+                {
+                    return ret;
+                }
+
+                iov_index = 0;
+                iovs = out_iovs_ + iov_index;
+                c0c3_cache_index = 0;
+                c0c3_cache = out_c0c3_caches_ + c0c3_cache_index;
+            }
+            continue;
+        }
+
         char* p = msg->payload;
         char* pend = msg->payload + msg->size;
 
         while(p<pend)
         {
-            int nbh = msg->ChunkHeader(c0c3_cache, p == msg->payload);
+            int nbh = 0;
+            if (p == msg->payload)
+            {
+                nbh = chunk_header_first(h->perfer_cid, msg->timestamp, h->payload_length, h->message_type, msg->stream_id, true, c0c3_cache);
+            }
+            else
+            {
+                nbh = msg->ChunkHeader(c0c3_cache, false);
+            }
 
+            iovs = reserve_iovs(iov_index, 2);
             iovs[0].iov_base = c0c3_cache;
             iovs[0].iov_len = nbh;
 
@@ -1115,13 +1728,6 @@ int Protocol::DoSendMessages(SharedPtrMessage** msgs, int nb_msgs)
             iovs[1].iov_len = payload_size;
 
             p += payload_size;
-            if (iov_index >= nb_out_iovs_ - 2){
-                rs_warn("resize out_iovs %d => %d", nb_out_iovs_, nb_out_iovs_ + RTMP_IOVS_MAX);
-                nb_out_iovs_ += RTMP_IOVS_MAX;
-                int relloc_size = sizeof(iovec) * nb_out_iovs_;
-                out_iovs_ = (iovec*)realloc(out_iovs_, relloc_size);
-            }
-
             iov_index += 2;
             iovs = out_iovs_ + iov_index;
 
@@ -1151,4 +1757,137 @@ int Protocol::DoSendMessages(SharedPtrMessage** msgs, int nb_msgs)
     return SendLargeIovs(rw_, out_iovs_, iov_index, nullptr);
 }
 
+int Protocol::HandoffSize()
+{
+    int nb_cs = 0;
+    for (int cid = 0; cid < RTMP_CHUNK_STREAM_CHCAHE; cid++)
+    {
+        if (cs_cache_[cid]->msg_count > 0)
+        {
+            nb_cs++;
+        }
+    }
+    nb_cs += (int)chunk_stream_.size();
+
+    return 4 * 4 + 2 + nb_cs * RTMP_HANDOFF_CHUNK_STREAM_SIZE + 4 + in_buffer_->Size();
+}
+
+int Protocol::EncodeHandoff(BufferManager *manager)
+{
+    int ret = ERROR_SUCCESS;
+
+    std::vector<ChunkStream *> css;
+    for (int cid = 0; cid < RTMP_CHUNK_STREAM_CHCAHE; cid++)
+    {
+        if (cs_cache_[cid]->msg_count > 0)
+        {
+            css.push_back(cs_cache_[cid]);
+        }
+    }
+    std::map<int, ChunkStream *>::iterator it;
+    for (it = chunk_stream_.begin(); it != chunk_stream_.end(); it++)
+    {
+        css.push_back(it->second);
+    }
+
+    for (size_t i = 0; i < css.size(); i++)
+    {
+        // a partial message is never expected between the commands, refuse to handoff it
+        if (css[i]->msg)
+        {
+            ret = ERROR_SYSTEM_WORKER_HANDOFF;
+            rs_warn("handoff with partial message, cid=%d, size=%d, ret=%d", css[i]->cid, css[i]->msg->size, ret);
+            return ret;
+        }
+    }
+
+    if (!manager->Require(HandoffSize()))
+    {
+        ret = ERROR_SYSTEM_WORKER_HANDOFF;
+        rs_error("handoff requires %d bytes protocol, ret=%d", HandoffSize(), ret);
+        return ret;
+    }
+
+    manager->Write4Bytes(in_chunk_size_);
+    manager->Write4Bytes(out_chunk_size_);
+    manager->Write4Bytes(in_ack_size_.window);
+    manager->Write4Bytes(out_ack_size_.window);
+
+    manager->Write2Bytes((int16_t)css.size());
+    for (size_t i = 0; i < css.size(); i++)
+    {
+        ChunkStream *cs = css[i];
+        manager->Write4Bytes(cs->cid);
+        manager->Write4Bytes(cs->header.timestamp_delta);
+        manager->Write4Bytes(cs->header.payload_length);
+        manager->Write1Bytes(cs->header.message_type);
+        manager->Write4Bytes(cs->header.stream_id);
+        manager->Write8Bytes(cs->header.timestamp);
+        manager->Write1Bytes(cs->extended_timestamp);
+        manager->Write4Bytes(cs->msg_count);
+    }
+
+    manager->Write4Bytes(in_buffer_->Size());
+    manager->WriteBytes(in_buffer_->Bytes(), in_buffer_->Size());
+
+    return ret;
+}
+
+int Protocol::DecodeHandoff(BufferManager *manager)
+{
+    int ret = ERROR_SUCCESS;
+
+    if (!manager->Require(4 * 4 + 2))
+    {
+        ret = ERROR_SYSTEM_WORKER_HANDOFF;
+        rs_error("handoff requires %d bytes protocol, ret=%d", 4 * 4 + 2, ret);
+        return ret;
+    }
+
+    in_chunk_size_ = manager->Read4Bytes();
+    out_chunk_size_ = manager->Read4Bytes();
+    in_ack_size_.window = manager->Read4Bytes();
+    out_ack_size_.window = manager->Read4Bytes();
+
+    int nb_cs = (uint16_t)manager->Read2Bytes();
+    if (!manager->Require(nb_cs * RTMP_HANDOFF_CHUNK_STREAM_SIZE + 4))
+    {
+        ret = ERROR_SYSTEM_WORKER_HANDOFF;
+        rs_error("handoff requires %d chunk streams, ret=%d", nb_cs, ret);
+        return ret;
+    }
+
+    for (int i = 0; i < nb_cs; i++)
+    {
+        ChunkStream *cs = fetch_chunk_stream(manager->Read4Bytes());
+        cs->header.timestamp_delta = manager->Read4Bytes();
+        cs->header.payload_length = manager->Read4Bytes();
+        cs->header.message_type = manager->Read1Bytes();
+        cs->header.stream_id = manager->Read4Bytes();
+        cs->header.timestamp = manager->Read8Bytes();
+        cs->extended_timestamp = manager->Read1Bytes();
+        cs->msg_count = manager->Read4Bytes();
+    }
+
+    int nb_left = manager->Read4Bytes();
+    if (nb_left < 0 || !manager->Require(nb_left))
+    {
+        ret = ERROR_SYSTEM_WORKER_HANDOFF;
+        rs_error("handoff requires %d bytes left data, ret=%d", nb_left, ret);
+        return ret;
+    }
+
+    if (nb_left > 0)
+    {
+        if ((ret = in_buffer_->Append(manager->Data() + manager->Pos(), nb_left)) != ERROR_SUCCESS)
+        {
+            rs_error("handoff restore left data failed, ret=%d", ret);
+            return ret;
+        }
+        manager->Skip(nb_left);
+    }
+
+    return ret;
 }
+
+} // namespace rtmp
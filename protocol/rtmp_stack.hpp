@@ -7,12 +7,14 @@
 #include <common/error.hpp>
 #include <common/log.hpp>
 #include <common/utils.hpp>
+#include <common/thread.hpp>
 #include <protocol/rtmp_amf0.hpp>
 #include <protocol/rtmp_packet.hpp>
 #include <protocol/rtmp_message.hpp>
 #include <protocol/rtmp_consts.hpp>
 #include <protocol/rtmp_handshake.hpp>
 
+#include <deque>
 #include <map>
 
 namespace rtmp
@@ -65,6 +67,10 @@ public:
     virtual Request *Copy();
     virtual std::string GetStreamUrl();
     virtual void Update(Request *req);
+    // serialize the identified request, for the stream affinity handoff between workers
+    virtual int HandoffSize();
+    virtual int EncodeHandoff(BufferManager *manager);
+    virtual int DecodeHandoff(BufferManager *manager);
 
 public:
     //base attributes
@@ -82,6 +88,8 @@ public:
     std::string param;
     std::string stream;
     double duration;
+    // start of play, in seconds. the positive start is the time shift from live
+    double start;
     AMF0Object *args;
 };
 
@@ -104,12 +112,57 @@ public:
 
 };
 
+// the last message sent on a chunk stream, for the fmt1/fmt2/fmt3 headers
+struct OutChunkStream
+{
+    bool valid;
+    // the delta is known by peer, sent by fmt1 or fmt2
+    bool has_delta;
+    uint32_t timestamp;
+    uint32_t delta;
+    int32_t payload_length;
+    int8_t message_type;
+    int32_t stream_id;
+};
+
+typedef std::deque<std::pair<uint32_t, SharedPtrMessage *> > ZeroCopyPins;
+
+// the zerocopy pins of the freed protocols, released when the kernel completes them
+class ZeroCopyReaper : public internal::IThreadHandler
+{
+public:
+    ZeroCopyReaper();
+    virtual ~ZeroCopyReaper();
+
+public:
+    virtual int32_t Initialize();
+    // take the dup fd of the socket and the pins
+    virtual void Push(int fd, ZeroCopyPins &pins);
+    // internal::IThreadHandler
+    virtual int32_t Cycle() override;
+
+private:
+    struct Grave
+    {
+        int fd;
+        ZeroCopyPins pins;
+        int64_t deadline;
+    };
+    std::vector<Grave *> graves_;
+    st_cond_t cond_;
+    internal::Thread *thread_;
+};
+
 class Protocol
 {
 
 public:
     Protocol(IProtocolReaderWriter *rw);
     virtual ~Protocol();
+
+    // allocated from the per thread slab pool
+    static void *operator new(size_t size);
+    static void operator delete(void *p, size_t size);
 public:
     virtual void SetSendTimeout(int64_t timeout_us);
     virtual void SetRecvTimeout(int64_t timeout_us);
@@ -120,6 +173,21 @@ public:
     virtual void SetRecvBuffer(int buffer_size);
     virtual void SetMargeRead(bool v, IMergeReadHandler *handler);
     virtual void SetAutoResponse(bool v);
+    // send the messages larger than threshold by MSG_ZEROCOPY, 0 to disable
+    virtual void SetZeroCopy(int threshold);
+    // reap the zerocopy completions, return true when any reaped
+    virtual bool ReapZeroCopy();
+    // send the first chunk of message with the smallest header, by the last message
+    // on the same chunk stream
+    virtual void SetHeaderCompression(bool v);
+    // pack the av messages of each send to the aggregate messages not larger than
+    // max_size, 0 to disable. the aggregate is never shared by the consumers
+    virtual void SetAggregate(int max_size);
+    // chunk stream state and the unparsed bytes, which are required to resume the
+    // connection in another worker process without handshake again
+    virtual int HandoffSize();
+    virtual int EncodeHandoff(BufferManager *manager);
+    virtual int DecodeHandoff(BufferManager *manager);
 
     template <typename T>
     int ExpectMessage(CommonMessage **pmsg, T **ppacket)
@@ -169,6 +237,9 @@ protected:
     virtual int ReadBasicHeader(char &fmt, int &cid);
     virtual int ReadMessageHeader(ChunkStream *cs, char fmt);
     virtual int ReadMessagePayload(ChunkStream *cs, CommonMessage **pmsg);
+    // the fmt3 chunks of the partial message buffered back to back, without the
+    // basic header and message header dispatch
+    virtual int ReadContinuationChunks(ChunkStream *cs, CommonMessage **pmsg);
     virtual int OnRecvMessage(CommonMessage *msg);
     virtual int ResponseAckMessage();
     virtual int DoDecodeMessage(MessageHeader &header, BufferManager *manager, Packet **packet);
@@ -177,6 +248,15 @@ protected:
     virtual int OnSendPacket(MessageHeader *header, Packet *packet);
     virtual int ManualResponseFlush();
     virtual int DoSendMessages(SharedPtrMessage** msgs, int nb_msgs);
+    virtual ChunkStream *fetch_chunk_stream(int cid);
+    virtual int send_zerocopy(SharedPtrMessage *msg, char *wire, int size);
+    // grow the out iovs for nb more iovecs after iov_index, return the iovs at iov_index
+    virtual iovec *reserve_iovs(int iov_index, int nb);
+    // return the number of messages after packed
+    virtual int pack_aggregate(SharedPtrMessage **msgs, int nb_msgs, int stream_id);
+    // the header of the first chunk, fmt0 when delta is not allowed
+    virtual int chunk_header_first(int cid, uint32_t timestamp, int32_t payload_length,
+                                   int8_t message_type, int32_t stream_id, bool delta, char *buf);
 
 private:
     IProtocolReaderWriter *rw_;
@@ -193,6 +273,20 @@ private:
     iovec* out_iovs_;
     int nb_out_iovs_;
     char out_c0c3_caches_[RTMP_C0C3_HEADERS_MAX];
+    IZeroCopyWriter *zerocopy_;
+    int zerocopy_threshold_;
+    bool header_compression_;
+    OutChunkStream out_cs_[RTMP_OUT_CHUNK_STREAMS];
+    int64_t nb_header_saved_bytes_;
+    int aggregate_size_;
+    int64_t nb_aggregated_msgs_;
+    int64_t nb_aggregates_;
+    // the payload bytes received, and those copied from the recv buffer
+    int64_t nb_payload_bytes_;
+    int64_t nb_copied_bytes_;
+    int64_t nb_continuation_chunks_;
+    // the messages pinned until the kernel completes the zerocopy id
+    ZeroCopyPins zerocopy_pins_;
 };
 
 } // namespace rtmp
@@ -0,0 +1,238 @@
+#include <protocol/time_shift.hpp>
+#include <protocol/rtmp_message.hpp>
+#include <protocol/rtmp_consumer.hpp>
+#include <common/config.hpp>
+#include <common/error.hpp>
+#include <common/log.hpp>
+#include <common/utils.hpp>
+
+#include <algorithm>
+
+namespace rtmp
+{
+
+thread_local std::vector<TimeShift *> TimeShift::buffers_;
+thread_local int64_t TimeShift::total_bytes_ = 0;
+
+static SharedPtrMessage *copy_at(SharedPtrMessage *msg, int64_t timestamp)
+{
+    if (!msg)
+    {
+        return nullptr;
+    }
+    SharedPtrMessage *cp = msg->Copy();
+    cp->timestamp = timestamp;
+    return cp;
+}
+
+TimeShift::TimeShift()
+{
+    base_seq_ = 0;
+    window_ms_ = 0;
+    bytes_ = 0;
+    last_cache_ms_ = 0;
+    buffers_.push_back(this);
+}
+
+TimeShift::~TimeShift()
+{
+    Clear();
+    std::vector<TimeShift *>::iterator it = std::find(buffers_.begin(), buffers_.end(), this);
+    if (it != buffers_.end())
+    {
+        buffers_.erase(it);
+    }
+}
+
+void TimeShift::SetWindow(double second)
+{
+    window_ms_ = (int64_t)(second * 1000);
+    if (window_ms_ <= 0)
+    {
+        Clear();
+    }
+}
+
+void TimeShift::Cache(SharedPtrMessage *msg,
+                      bool is_keyframe,
+                      SharedPtrMessage *metadata,
+                      SharedPtrMessage *sh_video,
+                      SharedPtrMessage *sh_audio)
+{
+    if (window_ms_ <= 0)
+    {
+        return;
+    }
+
+    // the buffer always starts at a keyframe
+    if (msgs_.empty() && !is_keyframe)
+    {
+        return;
+    }
+
+    if (is_keyframe)
+    {
+        KeyFrame kf;
+        kf.seq = base_seq_ + (int64_t)msgs_.size();
+        kf.timestamp = msg->timestamp;
+        kf.metadata = copy_at(metadata, msg->timestamp);
+        kf.sh_video = copy_at(sh_video, msg->timestamp);
+        kf.sh_audio = copy_at(sh_audio, msg->timestamp);
+        keyframes_.push_back(kf);
+    }
+
+    msgs_.push_back(msg->Copy());
+    last_cache_ms_ = Utils::GetSteadyMilliSeconds();
+    bytes_ += msg->MemorySize();
+    total_bytes_ += msg->MemorySize();
+
+    // keep the window covered by the gops after the oldest one
+    while (keyframes_.size() > 1 && msg->timestamp - keyframes_[1].timestamp >= window_ms_)
+    {
+        drop_gop();
+    }
+
+    apply_memory_cap();
+}
+
+int TimeShift::Dump(Consumer *consumer, double offset, bool atc, JitterAlgorithm ag)
+{
+    int ret = ERROR_SUCCESS;
+
+    if (keyframes_.empty())
+    {
+        return ret;
+    }
+
+    int64_t target = msgs_.back()->timestamp - (int64_t)(offset * 1000);
+    size_t index = 0;
+    for (size_t i = keyframes_.size(); i > 0; i--)
+    {
+        if (keyframes_[i - 1].timestamp <= target)
+        {
+            index = i - 1;
+            break;
+        }
+    }
+
+    KeyFrame &kf = keyframes_[index];
+    SharedPtrMessage *headers[] = {kf.metadata, kf.sh_audio, kf.sh_video};
+    for (int i = 0; i < 3; i++)
+    {
+        if (headers[i] && (ret = consumer->Enqueue(headers[i], atc, ag)) != ERROR_SUCCESS)
+        {
+            rs_error("dispatch time shift sequence header failed. ret=%d", ret);
+            return ret;
+        }
+    }
+
+    for (size_t i = (size_t)(kf.seq - base_seq_); i < msgs_.size(); i++)
+    {
+        if ((ret = consumer->Enqueue(msgs_[i], atc, ag)) != ERROR_SUCCESS)
+        {
+            rs_error("dispatch time shift failed. ret=%d", ret);
+            return ret;
+        }
+    }
+
+    rs_trace("dispatch time shift, offset=%.2f, shift=%lldms, count=%d",
+             offset, msgs_.back()->timestamp - kf.timestamp, (int)(msgs_.size() - (kf.seq - base_seq_)));
+    return ret;
+}
+
+void TimeShift::Clear()
+{
+    while (!keyframes_.empty())
+    {
+        drop_gop();
+    }
+}
+
+void TimeShift::Expire()
+{
+    if (msgs_.empty() || window_ms_ <= 0)
+    {
+        return;
+    }
+
+    if (Utils::GetSteadyMilliSeconds() - last_cache_ms_ >= window_ms_)
+    {
+        rs_trace("time shift idle for %lldms, clear %d msgs", Utils::GetSteadyMilliSeconds() - last_cache_ms_, (int)msgs_.size());
+        Clear();
+    }
+}
+
+bool TimeShift::Empty()
+{
+    return msgs_.empty();
+}
+
+int TimeShift::Duration()
+{
+    if (keyframes_.empty())
+    {
+        return 0;
+    }
+    return (int)(msgs_.back()->timestamp - keyframes_.front().timestamp);
+}
+
+int64_t TimeShift::Bytes()
+{
+    return bytes_;
+}
+
+int64_t TimeShift::TotalBytes()
+{
+    return total_bytes_;
+}
+
+void TimeShift::drop_gop()
+{
+    int64_t end = keyframes_.size() > 1 ? keyframes_[1].seq : base_seq_ + (int64_t)msgs_.size();
+    while (base_seq_ < end)
+    {
+        SharedPtrMessage *msg = msgs_.front();
+        bytes_ -= msg->MemorySize();
+        total_bytes_ -= msg->MemorySize();
+        rs_freep(msg);
+        msgs_.pop_front();
+        base_seq_++;
+    }
+
+    free_keyframe(keyframes_.front());
+    keyframes_.pop_front();
+}
+
+void TimeShift::free_keyframe(KeyFrame &kf)
+{
+    rs_freep(kf.metadata);
+    rs_freep(kf.sh_video);
+    rs_freep(kf.sh_audio);
+}
+
+void TimeShift::apply_memory_cap()
+{
+    // the memory is shared equally by the scheduler threads
+    int64_t cap = _config->GetTimeShiftMemory() / rs_max(1, _config->GetThreads());
+
+    // drop the oldest gop of the largest buffer, the current gop of each source is kept
+    while (total_bytes_ > cap)
+    {
+        TimeShift *largest = nullptr;
+        for (size_t i = 0; i < buffers_.size(); i++)
+        {
+            TimeShift *ts = buffers_[i];
+            if (ts->keyframes_.size() > 1 && (!largest || ts->bytes_ > largest->bytes_))
+            {
+                largest = ts;
+            }
+        }
+        if (!largest)
+        {
+            break;
+        }
+        largest->drop_gop();
+    }
+}
+
+} // namespace rtmp
@@ -0,0 +1,79 @@
+#ifndef RS_TIME_SHIFT_HPP
+#define RS_TIME_SHIFT_HPP
+
+#include <common/core.hpp>
+
+#include <deque>
+#include <vector>
+
+namespace rtmp
+{
+
+enum class JitterAlgorithm;
+class SharedPtrMessage;
+class Consumer;
+
+/**
+ * the multi gop time shift buffer of a source, indexed by keyframe, so the player can
+ * start from any recent keyframe. the buffer always starts at a keyframe, the oldest gop
+ * is dropped when out of the window or the memory of all buffers exceeds the cap.
+ * the messages are copies of the live messages, which share the payload.
+ */
+class TimeShift
+{
+public:
+    TimeShift();
+    virtual ~TimeShift();
+
+public:
+    virtual void SetWindow(double second);
+    // cache the av message, with the metadata and sequence headers to start from the keyframe
+    virtual void Cache(SharedPtrMessage *msg,
+                       bool is_keyframe,
+                       SharedPtrMessage *metadata,
+                       SharedPtrMessage *sh_video,
+                       SharedPtrMessage *sh_audio);
+    // dump from the newest keyframe at least offset seconds before the live
+    virtual int Dump(Consumer *consumer, double offset, bool atc, JitterAlgorithm ag);
+    virtual void Clear();
+    // clear when nothing cached for a window, the relay source never sees the unpublish
+    virtual void Expire();
+    virtual bool Empty();
+    virtual int Duration();
+    virtual int64_t Bytes();
+    // bytes of all time shift buffers
+    static int64_t TotalBytes();
+
+private:
+    struct KeyFrame
+    {
+        int64_t seq;
+        int64_t timestamp;
+        SharedPtrMessage *metadata;
+        SharedPtrMessage *sh_video;
+        SharedPtrMessage *sh_audio;
+    };
+
+    void drop_gop();
+    static void free_keyframe(KeyFrame &kf);
+    static void apply_memory_cap();
+
+private:
+    std::deque<SharedPtrMessage *> msgs_;
+    // sequence of the first message in msgs_
+    int64_t base_seq_;
+    std::deque<KeyFrame> keyframes_;
+    int64_t window_ms_;
+    // the payloads and their wire caches
+    int64_t bytes_;
+    // steady time of the last cached message
+    int64_t last_cache_ms_;
+
+    // the buffers of this scheduler thread
+    static thread_local std::vector<TimeShift *> buffers_;
+    static thread_local int64_t total_bytes_;
+};
+
+} // namespace rtmp
+
+#endif